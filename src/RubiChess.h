@@ -21,15 +21,19 @@
 //#define VERSTABLE
 
 #if 0
-#define STATISTICS
+#define SDEBUG
 #endif
 
 #if 0
-#define SDEBUG
+#define TDEBUG
 #endif
 
 #if 0
-#define TDEBUG
+#define PROFILING
+#endif
+
+#if 0
+#define SEARCHTRACE
 #endif
 
 #if 0
@@ -84,6 +88,9 @@
 #include <algorithm>
 #include <iterator>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <map>
 #include <time.h>
 #include <array>
@@ -91,6 +98,16 @@
 #include <limits.h>
 #include <math.h>
 #include <regex>
+#ifdef COROUTINES
+#include <coroutine>
+#endif
+#ifdef PROFILING
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #ifdef _WIN32
 
@@ -505,6 +522,7 @@ struct evalparamset {
 
 void registerallevals(chessposition* pos = nullptr);
 void initPsqtable();
+void initMaterialtable();
 
 #define SCALE_NORMAL 128
 #define SCALE_DRAW 0
@@ -741,6 +759,11 @@ void NnueReadNet(string path);
 #define HASHBETA    0x02
 #define HASHEXACT   0x00
 
+// Cuckoo tables of the hash differences of all reversible piece moves for the upcoming repetition detection
+#define CUCKOOSIZE 0x2000
+#define CUCKOOH1(h) ((h) & (CUCKOOSIZE - 1))
+#define CUCKOOH2(h) (((h) >> 16) & (CUCKOOSIZE - 1))
+
 class zobrist
 {
 public:
@@ -748,9 +771,12 @@ public:
     unsigned long long cstl[32];
     unsigned long long ept[64];
     unsigned long long s2m;
+    U64 cuckoo[CUCKOOSIZE];
+    uint16_t cuckoomove[CUCKOOSIZE];    // from << 6 | to
     ranctx rnd;
     zobrist();
     unsigned long long getRnd();
+    void initCuckoo();
     U64 getHash(chessposition *pos);
     U64 getPawnHash(chessposition *pos);
     U64 getMaterialHash(chessposition *pos);
@@ -794,7 +820,7 @@ public:
     ~transposition();
     int setSize(int sizeMb);    // returns the number of Mb not used by allignment
     void clean();
-    void addHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode);
+    void addHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode, bool clustershare = true);
     void printHashentry(U64 hash);
     bool probeHash(U64 hash, int *val, int *staticeval, uint16_t *movecode, int depth, int alpha, int beta, int ply);
     uint16_t getMoveCode(U64 hash);
@@ -846,31 +872,61 @@ public:
 };
 
 
-#define MATERIALHASHSIZE 0x10000
-#define MATERIALHASHMASK (MATERIALHASHSIZE - 1)
+// Compact entry of the shared pawn hash
+// Attack maps, semiopen files and flanks are cheap to rebuild from the pawn bitboards so only
+// the evaluation and the passers are stored. The check field contains the upper hash bits
+// xor'ed with the data so that a torn write by another thread is detected as a miss.
+struct sharedpawnhashentry {
+    uint32_t check;
+    int32_t value;
+    U64 passedpawns;    // passers of both colors, split by the pawn bitboards when retrieved
+};
 
+#define SHAREDPAWNHASHBUCKETNUM 4
+#define SHAREDPAWNHASHCHECK(h, v, p) ((uint32_t)((h) >> 32) ^ (uint32_t)(v) ^ (uint32_t)(p) ^ (uint32_t)((p) >> 32))
 
-struct Materialhashentry {
-    U64 hash;
-    int scale[2];
-    bool onlyPawns;
-    int numOfPawns;
-    int(*endgame)(chessposition*);
+struct sharedpawnhashcluster {
+    sharedpawnhashentry entry[SHAREDPAWNHASHBUCKETNUM];
 };
 
 
-class Materialhash
+class SharedPawnhash
 {
 public:
-    Materialhashentry *table;
-    void init();
+    sharedpawnhashcluster *table;
+    U64 sizemask;
+    size_t sizeInBytes;
+    void setSize(int sizeMb);
     void remove();
-    bool probeHash(U64 hash, Materialhashentry **entry);
+    bool probeHash(U64 hash, U64 *pawns, pawnhashentry *entry);
+    void addHash(U64 hash, pawnhashentry *entry);
+};
+
+
+// Material table indexed by the piece counts of both sides
+// Configurations with more than the regular number of pieces (after underpromotion or a second queen)
+// don't have an index and get their entry calculated on the fly.
+#define MTRLMAXPAWNS 8
+#define MTRLMAXPIECES 2
+#define MTRLMAXQUEENS 1
+#define MTRLCOLORSIZE ((MTRLMAXPAWNS + 1) * (MTRLMAXPIECES + 1) * (MTRLMAXPIECES + 1) * (MTRLMAXPIECES + 1) * (MTRLMAXQUEENS + 1))
+#define MATERIALTABLESIZE (MTRLCOLORSIZE * MTRLCOLORSIZE)
+
+
+struct materialentry {
+    int(*endgame)(chessposition*);
+    int16_t scale[2];
+    uint8_t numOfPawns;
+    bool onlyPawns;
+    bool ocbCandidate;  // scale SCALE_OCB if the bishops are on squares of different colors
 };
 
+extern materialentry materialtable[MATERIALTABLESIZE];
+
 
 extern zobrist zb;
 extern transposition tp;
+extern SharedPawnhash sph;
 
 
 //
@@ -927,6 +983,7 @@ const int castlerookto[4] = { 3, 5, 59, 61 };
 const int castlekingto[4] = { 2, 6, 58, 62 };
 
 #define MAXDEPTH 256
+#define PVTABLESIZE (MAXDEPTH * (MAXDEPTH + 1) / 2)
 #define MOVESTACKRESERVE 48     // to avoid checking for height reaching MAXDEPTH in probe_wds and getQuiescence
 
 #define NOSCORE SHRT_MIN
@@ -1156,6 +1213,28 @@ public:
     chessmove* getNextMove(int minval);
 };
 
+// Move lists of the search for one ply
+struct plymovelists
+{
+    chessmovelist captures;
+    chessmovelist quiets;
+};
+
+// Per thread store of the move lists; the lists of a ply are allocated when the thread reaches it for the first time.
+// Most threads never search deeper than a few dozen plies so the lists they don't need are never allocated.
+class movelistarena
+{
+    plymovelists *lists[MAXDEPTH][2];   // second index for the extra lists of singular testing
+public:
+    plymovelists* get(int ply, bool singular) {
+        plymovelists **l = &lists[ply][singular];
+        if (!*l)
+            *l = new plymovelists;
+        return *l;
+    }
+    void remove();
+};
+
 #define CMPLIES 2
 
 enum MoveSelector_State { INITSTATE, HASHMOVESTATE, TACTICALINITSTATE, TACTICALSTATE, KILLERMOVE1STATE, KILLERMOVE2STATE,
@@ -1187,45 +1266,51 @@ extern U64 knight_attacks[64];
 extern U64 king_attacks[64];
 
 struct SMagic {
-    U64 mask;  // to mask relevant squares of both lines (no outer squares)
-    U64 magic; // magic 64-bit factor
+    U64 mask;       // to mask relevant squares of both lines (no outer squares)
+    U64 magic;      // magic 64-bit factor
+    U64 *attacks;   // start of this square's attacks in mSliderAttacks
+    int shift;      // 64 - number of relevant squares
 };
 
 extern SMagic mBishopTbl[64];
 extern SMagic mRookTbl[64];
 
-#define BISHOPINDEXBITS 9
-#define ROOKINDEXBITS 12
+// Sum of 2^(relevant squares) over all squares; the tables of the squares are packed without padding
+#define BISHOPTABLESIZE 5248
+#define ROOKTABLESIZE 102400
 
 #ifdef USE_BMI2
 #include <immintrin.h>
 #define BISHOPINDEX(occ,i) (int)(_pext_u64(occ, mBishopTbl[i].mask))
 #define ROOKINDEX(occ,i) (int)(_pext_u64(occ, mRookTbl[i].mask))
 #else
-#define BISHOPINDEX(occ,i) (int)((((occ) & mBishopTbl[i].mask) * mBishopTbl[i].magic) >> (64 - BISHOPINDEXBITS))
-#define ROOKINDEX(occ,i) (int)((((occ) & mRookTbl[i].mask) * mRookTbl[i].magic) >> (64 - ROOKINDEXBITS))
+#define BISHOPINDEX(occ,i) (int)((((occ) & mBishopTbl[i].mask) * mBishopTbl[i].magic) >> mBishopTbl[i].shift)
+#define ROOKINDEX(occ,i) (int)((((occ) & mRookTbl[i].mask) * mRookTbl[i].magic) >> mRookTbl[i].shift)
 #endif
-#define BISHOPATTACKS(m,x) (mBishopAttacks[x][BISHOPINDEX(m,x)])
-#define ROOKATTACKS(m,x) (mRookAttacks[x][ROOKINDEX(m,x)])
+#define BISHOPATTACKS(m,x) (mBishopTbl[x].attacks[BISHOPINDEX(m,x)])
+#define ROOKATTACKS(m,x) (mRookTbl[x].attacks[ROOKINDEX(m,x)])
 
-extern U64 mBishopAttacks[64][1 << BISHOPINDEXBITS];
-extern U64 mRookAttacks[64][1 << ROOKINDEXBITS];
+extern U64 mSliderAttacks[BISHOPTABLESIZE + ROOKTABLESIZE];
 
 enum MoveType { QUIET = 1, CAPTURE = 2, PROMOTE = 4, TACTICAL = 6, ALL = 7 };
 enum RootsearchType { SinglePVSearch, MultiPVSearch };
 
 int CreateEvasionMovelist(chessposition *pos, chessmove* mstart);
+template <int Me> int CreateEvasionMovelist(chessposition *pos, chessmove* mstart);
+int CreateLegalMovelist(chessposition *pos, chessmove* mstart);
+template <int Me> int CreateLegalMovelist(chessposition *pos, chessmove* mstart);
 template <MoveType Mt> int CreateMovelist(chessposition *pos, chessmove* mstart);
-template <PieceType Pt> inline int CreateMovelistPiece(chessposition *pos, chessmove* mstart, U64 occ, U64 targets, int me);
-template <MoveType Mt> inline int CreateMovelistPawn(chessposition *pos, chessmove* mstart, int me);
-inline int CreateMovelistCastle(chessposition *pos, chessmove* mstart, int me);
+template <MoveType Mt, int Me> int CreateMovelist(chessposition *pos, chessmove* mstart);
+template <PieceType Pt, int Me> inline int CreateMovelistPiece(chessposition *pos, chessmove* mstart, U64 occ, U64 targets);
+template <MoveType Mt, int Me> inline int CreateMovelistPawn(chessposition *pos, chessmove* mstart);
+template <int Me> inline int CreateMovelistCastle(chessposition *pos, chessmove* mstart);
 template <MoveType Mt> void evaluateMoves(chessmovelist *ml, chessposition *pos, int16_t **cmptr);
 
 enum AttackType { FREE, OCCUPIED, OCCUPIEDANDKING };
 
 struct positioneval {
     pawnhashentry *phentry;
-    Materialhashentry *mhentry;
+    materialentry *mhentry;
     int kingattackpiececount[2][7] = { { 0 } };
     int kingringattacks[2] = { 0 };
     int kingattackers[2];
@@ -1240,10 +1325,67 @@ enum PvAbortType {
 // Replace the occupied bitboards with the first two so far unused piece bitboards
 #define occupied00 piece00
 
+// Counters of a search thread; only the owning thread writes them, others sum them up with relaxed loads.
+// They live on their own cache line so that counting doesn't invalidate the lines read by other threads.
+struct alignas(64) threadcounters
+{
+    atomic<U64> nodes;
+    atomic<U64> tbhits;
+    void addNode() { nodes.store(nodes.load(memory_order_relaxed) + 1, memory_order_relaxed); }
+    void addTbhit() { tbhits.store(tbhits.load(memory_order_relaxed) + 1, memory_order_relaxed); }
+};
+
+// Search statistics of a thread, enabled at runtime with the SearchStatistics option.
+// All members are 64bit counters so the statistics of the threads can be summed up as an array.
+struct alignas(64) statistic {
+    U64 qs_n[2];                // total calls to qs split into no check / check
+    U64 qs_tt;                  // qs hits tt
+    U64 qs_pat;                 // qs returns with pat score
+    U64 qs_delta;               // qs return with delta pruning before move loop
+    U64 qs_loop_n;              // qs enters moves loop
+    U64 qs_move_delta;          // qs moves delta-pruned
+    U64 qs_moves;               // moves done in qs
+    U64 qs_moves_fh;            // qs moves that cause a fail high
+
+    U64 ab_n;                   // total calls to alphabeta
+    U64 ab_pv;                  // number of PV nodes
+    U64 ab_tt;                  // alphabeta exit by tt hit
+    U64 ab_draw_or_win;         // alphabeta returns draw or mate score
+    U64 ab_qs;                  // alphabeta calls qsearch
+    U64 ab_tb;                  // alphabeta exits with tb score
+    U64 ab_type[3];             // alphabeta nodes that finished the moves loop indexed by bound: exact (pv), alpha (all), beta (cut)
+
+    U64 prune_futility;         // nodes pruned by reverse futility
+    U64 prune_nm;               // nodes pruned by null move;
+    U64 prune_probcut;          // nodes pruned by PobCut
+    U64 prune_multicut;         // nodes pruned by Multicut (detected by failed singular test)
+
+    U64 moves_loop_n;           // counts how often the moves loop is entered
+    U64 moves_n[2];             // all moves in alphabeta move loop split into quites ans tactical
+    U64 moves_pruned_lmp;       // moves pruned by lmp
+    U64 moves_pruned_futility;  // moves pruned by futility
+    U64 moves_pruned_badsee;    // moves pruned by bad see
+    U64 moves_played[2];        // moves that are played split into quites ans tactical
+    U64 moves_fail_high;        // moves that cause a fail high;
+    U64 moves_fail_high_first;  // fail highs by the first legal move
+    U64 moves_bad_hash;         // hash moves that are repicked in the bad tactical stage
+
+    U64 red_total;              // total reductions
+    U64 red_lmr[2];             // total late-move-reductions for (not) improved moves
+    U64 red_pi[2];              // number of quiets moves that are reduced split into (not) / improved moves
+    S64 red_history;            // total reduction by history
+    S64 red_pv;                 // total reduction by pv nodes
+    S64 red_correction;         // total reduction correction by over-/underflow
+    U64 red_smpmarked;          // additional reductions of nodes currently searched by another thread
+
+    U64 extend_singular;        // total singular extensions
+    U64 extend_endgame;        // total endgame extensions
+    U64 extend_history;        // total history extensions
+};
+
 class chessposition
 {
 public:
-    U64 nodes;
     int mstop;      // 0 at last non-reversible move before root, rootheight at root position
     int ply;        // 0 at root position
 
@@ -1266,9 +1408,6 @@ public:
     U64 kingPinned;
 
     uint8_t mailbox[BOARDSIZE]; // redundand for faster "which piece is on field x"
-    chessmovestack movestack[MAXDEPTH];
-    uint16_t excludemovestack[MAXDEPTH];
-    int16_t staticevalstack[MAXDEPTH];
 
     int rootheight; // fixed stack offset in root position 
     int seldepth;
@@ -1279,13 +1418,9 @@ public:
     int bestmovescore[MAXMULTIPV];
     int lastbestmovescore;
     chessmove pondermove;
-    int LegalMoves[MAXDEPTH];
-    uint32_t killer[MAXDEPTH][2];
     uint32_t bestFailingLow;
     int threadindex;
     int psqval;
-    uint32_t pvtable[MAXDEPTH][MAXDEPTH];
-    uint32_t multipvtable[MAXMULTIPV][MAXDEPTH];
     uint32_t lastpv[MAXDEPTH];
     int ph; // to store the phase during different evaluation functions
     int sc; // to stor scaling factor used for evaluation
@@ -1293,10 +1428,6 @@ public:
     int useRootmoveScore;
     int tbPosition;
     chessmove defaultmove; // fallback if search in time trouble didn't finish a single iteration
-    chessmovelist captureslist[MAXDEPTH];
-    chessmovelist quietslist[MAXDEPTH];
-    chessmovelist singularcaptureslist[MAXDEPTH];   // extra move lists for singular testing
-    chessmovelist singularquietslist[MAXDEPTH];
 #ifdef EVALTUNE
     bool isQuiet;
     bool noQs;
@@ -1314,6 +1445,12 @@ public:
         U64 hash;
     } pvdebug[MAXDEPTH];
 #endif
+    // Stacks of the search; copyRootState only copies the moves before the root that are needed for repetition detection
+    chessmovestack movestack[MAXDEPTH];
+    uint16_t excludemovestack[MAXDEPTH];
+    int16_t staticevalstack[MAXDEPTH];
+    int LegalMoves[MAXDEPTH];
+    uint32_t killer[MAXDEPTH][2];
     // The following part of the chessposition object isn't copied from rootposition object to the threads positions
     int16_t history[2][64][64];
     int16_t counterhistory[14][64][14 * 64];
@@ -1322,8 +1459,14 @@ public:
     int he_threshold;
     U64 he_yes;
     U64 he_all;
-    Materialhash mtrlhsh;
     Pawnhash pwnhsh;
+    SharedPawnhash *sphsh;          // shared pawn hash if enabled; pwnhsh is unused then
+    pawnhashentry sharedphentry;    // unpacked entry of the shared pawn hash
+    threadcounters counters;
+    statistic statistics;
+    uint32_t pvtable[PVTABLESIZE];  // triangular; the pv of ply p starts at pvline(p) with room for MAXDEPTH - p moves
+    uint32_t multipvtable[MAXMULTIPV][MAXDEPTH];
+    movelistarena movelists;
 #ifdef SDEBUG
     unsigned long long debughash = 0;
     int pvalpha[MAXDEPTH];
@@ -1334,6 +1477,9 @@ public:
     int pvabortval[MAXDEPTH];
     string pvadditionalinfo[MAXDEPTH];
 #endif
+#ifdef SEARCHTRACE
+    uint8_t traceexit[MAXDEPTH];
+#endif
 #ifdef NNUE
     NnueAccumulator accumulator[MAXDEPTH];
     DirtyPiece dirtypiece[MAXDEPTH];
@@ -1359,9 +1505,13 @@ public:
     void getRootMoves();
     void tbFilterRootMoves();
     void prepareStack();
+    void copyRootState(chessposition *src);
     string movesOnStack();
-    bool playMove(chessmove *cm);
-    void unplayMove(chessmove *cm);
+    template <int Me> bool playMove(chessmove *cm);
+    template <int Me> void unplayMove(chessmove *cm);
+    // dispatch the side to move once; make/unmake are specialized on color
+    bool playMove(chessmove *cm) { return (state & S2MMASK) ? playMove<BLACK>(cm) : playMove<WHITE>(cm); }
+    void unplayMove(chessmove *cm) { if (state & S2MMASK) unplayMove<WHITE>(cm); else unplayMove<BLACK>(cm); }
     void playNullMove();
     void unplayNullMove();
     template <int Me> void updatePins();
@@ -1369,23 +1519,29 @@ public:
     bool moveGivesCheck(uint32_t c);  // simple and imperfect as it doesn't handle special moves and cases (mainly to avoid pruning of important moves)
     bool moveIsPseudoLegal(uint32_t c);     // test if move is possible in current position
     uint32_t shortMove2FullMove(uint16_t c); // transfer movecode from tt to full move code without checking if pseudoLegal
-    int getpsqval(bool showDetails = false);  // only for eval trace and mirror test
+    template <EvalType Et> int getpsqval(bool showDetails = false);  // only for eval trace and mirror test
     template <EvalType Et, int Me> int getGeneralEval(positioneval *pe);
     template <EvalType Et, PieceType Pt, int Me> int getPieceEval(positioneval *pe);
     template <EvalType Et, int Me> int getLateEval(positioneval *pe);
     template <EvalType Et, int Me> void getPawnAndKingEval(pawnhashentry *entry);
     template <EvalType Et> int getEval();
-    void getScaling(Materialhashentry *mhentry);
-    int getComplexity(int eval, pawnhashentry *phentry, Materialhashentry *mhentry);
+    int getMaterialIndex();
+    int getComplexity(int eval, pawnhashentry *phentry, materialentry *mhentry);
 
     template <RootsearchType RT> int rootsearch(int alpha, int beta, int depth, int inWindowLast);
     int alphabeta(int alpha, int beta, int depth);
     int getQuiescence(int alpha, int beta, int depth);
+#ifdef SEARCHTRACE
+    int alphabetaNode(int alpha, int beta, int depth);
+    int getQuiescenceNode(int alpha, int beta, int depth);
+    void traceNode(int alpha, int beta, int depth, int score, int flags, U64 nodes);
+#endif
     void updateHistory(uint32_t code, int16_t **cmptr, int value);
     void updateTacticalHst(uint32_t code, int value);
     void getCmptr(int16_t **cmptr);
     void updatePvTable(uint32_t mc, bool recursive);
     void updateMultiPvTable(int pvindex, uint32_t mc);
+    uint32_t* pvline(int p) { return pvtable + p * MAXDEPTH - p * (p - 1) / 2; }
     string getPv(uint32_t *table);
     int applyPv(uint32_t* table);
     void reapplyPv(uint32_t* table, int num);
@@ -1399,6 +1555,7 @@ public:
     void pvdebugout();
 #endif
     int testRepetiton();
+    bool upcomingRepetition();
     void mirror();
 #ifdef NNUE
     template <NnueType Nt> void HalfkpAppendActiveIndices(int c, NnueIndexList *active);
@@ -1416,12 +1573,15 @@ public:
 // uci stuff
 //
 
-enum GuiToken { UNKNOWN, UCI, UCIDEBUG, ISREADY, SETOPTION, REGISTER, UCINEWGAME, POSITION, GO, STOP, PONDERHIT, QUIT, EVAL, PERFT, TUNE
+enum GuiToken { UNKNOWN, UCI, UCIDEBUG, ISREADY, SETOPTION, REGISTER, UCINEWGAME, POSITION, GO, STOP, PONDERHIT, QUIT, EVAL, PERFT, DIVIDE, TUNE, PROFILE
 };
 
 const map<string, GuiToken> GuiCommandMap = {
 #ifdef EVALTUNE
     { "tune", TUNE },
+#endif
+#ifdef PROFILING
+    { "profile", PROFILE },
 #endif
     { "uci", UCI },
     { "debug", UCIDEBUG },
@@ -1435,7 +1595,8 @@ const map<string, GuiToken> GuiCommandMap = {
     { "ponderhit", PONDERHIT },
     { "quit", QUIT },
     { "eval", EVAL },
-    { "perft", PERFT }
+    { "perft", PERFT },
+    { "divide", DIVIDE }
 };
 
 //
@@ -1525,6 +1686,9 @@ public:
 };
 
 
+// Why the main thread finished the search; written to the TimeLogFile
+enum TimeStopReason { TSR_SOFT = 0, TSR_HARD, TSR_SINGLEMOVE, TSR_DEPTH, TSR_NODES, TSR_STOP, TSR_NUM };
+
 class engine
 {
 public:
@@ -1532,10 +1696,9 @@ public:
     ~engine();
     const char* author = "Andreas Matthies";
     bool isWhite;
-    U64 tbhits;
     U64 starttime;
-    U64 endtime1; // time to stop before starting next iteration
-    U64 endtime2; // time to stop immediately
+    atomic<U64> endtime1; // time to stop before starting next iteration
+    atomic<U64> endtime2; // time to stop immediately; raised by the timer thread
     U64 frequency;
     int wtime, btime, winc, binc, movestogo, mate, movetime, maxdepth;
     U64 maxnodes;
@@ -1543,14 +1706,29 @@ public:
     bool debug = false;
     bool evaldetails = false;
     bool moveoutput;
-    int stopLevel = ENGINETERMINATEDSEARCH;
+    // polled by all search threads; on its own cache line followed by data that doesn't change while searching
+    alignas(64) atomic<int> stopLevel { ENGINETERMINATEDSEARCH };
+    bool SearchStatistics;
+    bool smpMarking;    // threads search nodes that another thread is searching with more reduction
+    atomic<ponderstate_t> pondersearch { NO };
     int Hash;
     int restSizeOfTp = 0;
     int sizeOfPh;
+    bool SharedPawnHash;
+    int ClusterPort;
+    string ClusterHost;
     int moveOverhead;
     int MultiPV;
     bool ponder;
     bool chess960;
+#ifdef SEARCHTRACE
+    string SearchTraceFile;
+#endif
+    string TimeLogFile;
+    FILE *timelog = nullptr;
+    U64 plannedendtime1;            // endtime1 and endtime2 as calculated at the start of the search
+    U64 plannedendtime2;
+    atomic<U64> timerstoptime;      // time when the timer thread raised the stop flag, 0 otherwise
     string SyzygyPath;
     bool Syzygy50MoveRule = true;
     int SyzygyProbeLimit;
@@ -1558,7 +1736,16 @@ public:
     int Threads;
     int oldThreads;
     searchthread *sthread;
-    ponderstate_t pondersearch;
+    mutex poolmutex;
+    condition_variable poolstart;   // wakes up the parked search threads
+    condition_variable poolidle;    // signals that all threads finished their search
+    int poolgeneration;
+    int poolsearching;
+    bool poolexit;
+    mutex timermutex;
+    condition_variable timerwake;   // wakes up the timer thread when endtime2 or the state of the search changes
+    thread timerthr;
+    bool timerexit;
     bool ponderhit;
     int terminationscore = SHRT_MAX;
     int lastReport;
@@ -1574,6 +1761,7 @@ public:
     int t1stop = 0;     // regular stop
     int t2stop = 0;     // immediate stop
     bool bStopCount;
+    int overshoot[8];   // histogram of the time between endtime2 and output of bestmove
 #endif
 #ifdef NNUE
     string NnueNetpath;
@@ -1587,8 +1775,10 @@ public:
     void send(const char* format, ...);
     void communicate(string inputstring);
     void allocThreads();
+    size_t getMemoryUsage(bool verbose = false);
     U64 getTotalNodes();
-    long long perft(int depth, bool dotests);
+    U64 getTotalTbhits();
+    long long perft(int depth, bool dotests, bool divide = false);
     void prepareThreads();
     void resetStats();
 };
@@ -1599,10 +1789,11 @@ PieceType GetPieceType(char c);
 struct enginestate
 {
 public:
-    int phase;
+    atomic<int> phase;
+    atomic<bool> dead;      // set by the reader when the engine closed its output
     string bestmoves;
     string avoidmoves;
-    clock_t starttime;
+    long long starttime;
     int firstbesttimesec;
     int score;
     int allscore;
@@ -1636,16 +1827,25 @@ public:
     int depth;
     int numofthreads;
     int lastCompleteDepth;
+    U64 firstnodetime;  // for measuring the latency of starting the search
     // adjust padding to align searchthread at 64 bytes
-    uint8_t padding[16];
+    uint8_t padding[8];
 
     searchthread *searchthreads;
 };
 
+void createSearchThreads();
+void removeSearchThreads();
+void wakeTimer();
+#ifdef COROUTINES
+U64 coroutineSearch(int tasks, int msec);
+#endif
 void searchStart();
 void searchWaitStop(bool forceStop = true);
 void searchinit();
 void resetEndTime(int constantRootMoves, bool complete = true);
+bool timeLogOpen(string filename);
+void timeLogAnalyze(string filename);
 
 
 //
@@ -1661,65 +1861,235 @@ int root_probe_wdl(chessposition *pos);
 
 
 //
-// statistics stuff
+// cluster stuff
 //
-#ifdef STATISTICS
-struct statistic {
-    U64 qs_n[2];                // total calls to qs split into no check / check
-    U64 qs_tt;                  // qs hits tt
-    U64 qs_pat;                 // qs returns with pat score
-    U64 qs_delta;               // qs return with delta pruning before move loop
-    U64 qs_loop_n;              // qs enters moves loop
-    U64 qs_move_delta;          // qs moves delta-pruned
-    U64 qs_moves;               // moves done in qs
-    U64 qs_moves_fh;            // qs moves that cause a fail high
+#define CLUSTERMAXNODES 64
+#define CLUSTERTTMINDEPTH 8     // only deep tt entries are shared with other processes
+#define CLUSTERFLUSHMS 10       // send queued tt entries every 10ms
+#define CLUSTERMAXMESSAGE (1 << 20) // larger messages are rejected; tt entries are sent in chunks of this size
+#define CLUSTERMAGIC 0x52434c31 // "RCL1"; the first message of a worker, peers without it are dropped
+#define CLUSTERHANDSHAKEMS 2000
 
-    U64 ab_n;                   // total calls to alphabeta
-    U64 ab_pv;                  // number of PV nodes
-    U64 ab_tt;                  // alphabeta exit by tt hit
-    U64 ab_draw_or_win;         // alphabeta returns draw or mate score
-    U64 ab_qs;                  // alphabeta calls qsearch
-    U64 ab_tb;                  // alphabeta exits with tb score
+enum ClusterMessageType { CLUSTERCOMMAND, CLUSTERTT, CLUSTERRESULT, CLUSTERHELLO, CLUSTERGO };
 
-    U64 prune_futility;         // nodes pruned by reverse futility
-    U64 prune_nm;               // nodes pruned by null move;
-    U64 prune_probcut;          // nodes pruned by PobCut
-    U64 prune_multicut;         // nodes pruned by Multicut (detected by failed singular test)
+struct clusterttentry {
+    U64 hash;
+    int16_t value;
+    int16_t staticeval;
+    uint16_t movecode;
+    uint8_t depth;
+    uint8_t bound;
+};
 
-    U64 moves_loop_n;           // counts how often the moves loop is entered
-    U64 moves_n[2];             // all moves in alphabeta move loop split into quites ans tactical
-    U64 moves_pruned_lmp;       // moves pruned by lmp
-    U64 moves_pruned_futility;  // moves pruned by futility
-    U64 moves_pruned_badsee;    // moves pruned by bad see
-    U64 moves_played[2];        // moves that are played split into quites ans tactical
-    U64 moves_fail_high;        // moves that cause a fail high;
-    U64 moves_bad_hash;         // hash moves that are repicked in the bad tactical stage
+struct clusterresult {
+    int searchnum;
+    int depth;
+    int score;
+    uint32_t pv[MAXDEPTH];
+};
 
-    U64 red_total;              // total reductions
-    U64 red_lmr[2];             // total late-move-reductions for (not) improved moves
-    U64 red_pi[2];              // number of quiets moves that are reduced split into (not) / improved moves
-    S64 red_history;            // total reduction by history
-    S64 red_pv;                 // total reduction by pv nodes
-    S64 red_correction;         // total reduction correction by over-/underflow
+class Cluster
+{
+public:
+    bool enabled;       // connected to other processes; share tt entries
+    int rank;           // 0 for the master process that talks to the GUI
+    int port;
+    int searchnum;      // number of the current search to ignore late results of older searches
+    bool startMaster(int listenport);
+    bool startWorker(string hostport);
+    void workerLoop();
+    void stop();
+    int numOfWorkers() { return numsocks; }
+    void sendCommand(string cmd);
+    void queueHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode);
+    void sendResult(int depth, int score, uint32_t *pv);
+    bool getBestResult(int mindepth, int minscore, clusterresult *result);
+    ~Cluster() { stop(); }
+private:
+    int listensock;
+    // written by the accept thread; a new peer is published by incrementing numsocks, a dead peer gets socket -1
+    atomic<int> socks[CLUSTERMAXNODES];
+    atomic<int> numsocks;
+    bool terminating;
+    mutex sendmutex;
+    mutex queuemutex;
+    mutex resultmutex;
+    vector<clusterttentry> ttqueue;
+    clusterresult results[CLUSTERMAXNODES];
+    thread acceptthr;
+    thread flushthr;
+    thread receivethr[CLUSTERMAXNODES];
+    void acceptLoop();
+    bool acceptHandshake(int sock);
+    void flushLoop();
+    void receiveLoop(int peer);
+    void mergeHash(clusterttentry *e, int num);
+    bool sendMessage(int peer, uint32_t type, const void *data, uint32_t length);
+    void broadcast(uint32_t type, const void *data, uint32_t length, int exceptpeer = -1);
+};
 
-    U64 extend_singular;        // total singular extensions
-    U64 extend_endgame;        // total endgame extensions
-    U64 extend_history;        // total history extensions
+extern Cluster cl;
+
+
+//
+// search tree tracing
+//
+
+// Exit of a traced node; TE_MOVELOOP for nodes that searched their moves, the node type follows from score vs. alpha/beta then
+enum TraceExit { TE_MOVELOOP = 0, TE_DRAW, TE_STOP, TE_TT, TE_TB, TE_QSEARCH, TE_RAZOR, TE_REVFUTILITY, TE_NULLMOVE,
+    TE_PROBCUT, TE_MULTICUT, TE_MATE, TE_STANDPAT, TE_DELTA, TE_NUM };
+
+#define TRACEQS         0x01    // node of getQuiescence
+#define TRACEPVNODE     0x02    // open window
+#define TRACECHECK      0x04    // side to move is in check
+#define TRACESINGULAR   0x08    // singular extension search with an excluded move
+#define TRACESEARCH     0x80    // marker for a new search; only hash (of the root position) and thread are valid
+
+// One node of the search tree in the trace file
+struct tracerecord {
+    U64 hash;
+    int16_t alpha;
+    int16_t beta;
+    int16_t score;
+    int16_t depth;
+    uint32_t nodes;     // alphabeta nodes of the subtree including this one
+    uint8_t ply;
+    uint8_t flags;
+    uint8_t exit;
+    uint8_t thread;
 };
 
-extern struct statistic statistics;
+#define TRACEMAGIC "RCST"
+#define TRACEVERSION 1
+
+struct tracefileheader {
+    char magic[4];
+    uint32_t version;
+    uint32_t recordsize;
+    uint32_t reserved;
+};
+
+void traceAnalyze(string filename);
+
+#ifdef SEARCHTRACE
+// Every search thread writes its nodes to its own ring buffer; a writer thread flushes them to the trace file.
+// A full buffer blocks the search thread until the writer caught up so the trace is always complete.
+#define TRACEBUFFERSIZE (1 << 16)
+#define TRACEFLUSHMS 10
+
+struct tracebuffer {
+    tracerecord record[TRACEBUFFERSIZE];
+    alignas(64) atomic<U64> head;   // next record to write; only stored by the search thread
+    alignas(64) atomic<U64> tail;   // next record to flush; only stored by the writer thread
+};
+
+class SearchTrace
+{
+public:
+    bool start(string filename);
+    void stop();
+    void newSearch(int threads, U64 roothash);
+    void write(int threadindex, tracerecord *r);
+    ~SearchTrace() { stop(); }
+private:
+    FILE *file = nullptr;
+    tracebuffer *buffer[MAXTHREADS] = { nullptr };
+    atomic<bool> terminating;
+    mutex buffermutex;
+    thread writerthr;
+    void writerLoop();
+    void flush();
+};
+
+extern SearchTrace strace;
+#define TRACEEXIT(x) traceexit[ply] = (x)
+#else
+#define TRACEEXIT(x)
+#endif
+
+
+//
+// statistics stuff
+//
 
 void search_statistics();
 
-// some macros to limit the ifdef STATISTICS inside the code
-#define STATISTICSINC(x)        statistics.x++ 
-#define STATISTICSADD(x, v)     statistics.x += (v)
+// some macros to keep the statistics code short; with SearchStatistics disabled counting costs a well predicted branch
+#define STATISTICSINC(x)        do { if (en.SearchStatistics) statistics.x++; } while (0)
+#define STATISTICSADD(x, v)     do { if (en.SearchStatistics) statistics.x += (v); } while (0)
 #define STATISTICSDO(x)         x
 
+#ifdef PROFILING
+//
+// Scoped cycle counting of the hot paths; times of nested sections are included in the outer section.
+// Every thread counts into its own thread local block; profilePrint sums them up. Use the 'profile' command or -bench.
+//
+enum ProfileSection { PROF_EVALCLASSICAL, PROF_EVALNNUE, PROF_NNUEUPDATE, PROF_NNUEREFRESH, PROF_NNUEPROPAGATE,
+    PROF_MOVEGEN, PROF_MOVESELECTOR, PROF_SEE, PROF_PROBEHASH, PROF_ADDHASH, PROF_PROBEWDL, PROF_PLAYMOVE, PROF_UNPLAYMOVE, PROF_NUM };
+
+struct alignas(64) profiledata {
+    U64 cycles[PROF_NUM];
+    U64 calls[PROF_NUM];
+};
+
+extern thread_local profiledata *profilethread;
+profiledata* profileRegisterThread();
+void profileUnregisterThread();
+void profileReset();
+void profilePrint(FILE *out);
+
+inline U64 profileCycles()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+    return __rdtsc();
+#else
+    return getTime();
+#endif
+}
+
+class profilescope
+{
+    int section;
+    U64 start;
+public:
+    profilescope(int s) { section = s; start = profileCycles(); }
+    ~profilescope() {
+        profiledata *pd = (profilethread ? profilethread : profileRegisterThread());
+        pd->cycles[section] += profileCycles() - start;
+        pd->calls[section]++;
+    }
+};
+
+#define PROFILESCOPE(s) profilescope profscope_##s(s)
 #else
-#define STATISTICSINC(x)
-#define STATISTICSADD(x, v)
-#define STATISTICSDO(x)
+#define PROFILESCOPE(s)
 #endif
 
+//
+// Performance counters of all threads of the process around a benchmark position (perf_event_open, Linux only).
+// Without access to the PMU (e.g. in a VM) the kernels software counters are used instead.
+//
+enum PerfCounterMode { PERFNONE, PERFSOFTWARE, PERFHARDWARE };
+enum PerfCounter { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1DMISSES, PERF_LLCMISSES, PERF_DTLBMISSES, PERF_BRANCHMISSES, PERF_NUM };
+enum PerfSoftCounter { PERF_TASKCLOCK, PERF_PAGEFAULTS, PERF_CONTEXTSWITCHES, PERF_MIGRATIONS, PERF_SOFTNUM };
+
+struct perfcountervalues {
+    U64 value[PERF_NUM];
+    bool valid[PERF_NUM];
+};
+
+class perfcounters
+{
+    int fd[MAXTHREADS + 1][PERF_NUM];
+    int numtasks;
+    int openCounter(int tid, int counter);
+public:
+    PerfCounterMode mode = PERFNONE;
+    perfcounters() { numtasks = 0; }
+    ~perfcounters() { perfcountervalues v; stop(&v); }
+    PerfCounterMode init();
+    void start();
+    void stop(perfcountervalues *v);
+};
+
 
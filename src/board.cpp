@@ -637,6 +637,30 @@ int chessposition::testRepetiton()
 }
 
 
+// Test if a reversible move leads to a position of the search path; idea by Marcel van Kervinck using cuckoo tables
+bool chessposition::upcomingRepetition()
+{
+    // Only repetitions inside the search tree count; positions before the root would need to be repeated twice
+    int lastrepply = max(mstop - halfmovescounter, max(lastnullmove, rootheight) + 1);
+    U64 occupied = occupied00[0] | occupied00[1];
+    for (int i = mstop - 3; i >= lastrepply; i -= 2)
+    {
+        U64 movekey = hash ^ movestack[i].hash;
+        int j = CUCKOOH1(movekey);
+        if (zb.cuckoo[j] != movekey)
+        {
+            j = CUCKOOH2(movekey);
+            if (zb.cuckoo[j] != movekey)
+                continue;
+        }
+        int from = zb.cuckoomove[j] >> 6;
+        int to = zb.cuckoomove[j] & 0x3f;
+        if (!(betweenMask[from][to] & occupied))
+            return true;
+    }
+    return false;
+}
+
 
 void chessposition::mirror()
 {
@@ -1103,12 +1127,12 @@ string chessposition::toFen()
 
 void chessposition::updateMultiPvTable(int pvindex, uint32_t mc)
 {
-    uint32_t *table = (pvindex ? multipvtable[pvindex] : pvtable[0]);
+    uint32_t *table = (pvindex ? multipvtable[pvindex] : pvline(0));
     table[0] = mc;
     int i = 0;
-    while (pvtable[1][i])
+    while (pvline(1)[i])
     {
-        table[i + 1] = pvtable[1][i];
+        table[i + 1] = pvline(1)[i];
         i++;
     }
     table[i + 1] = 0;
@@ -1117,17 +1141,17 @@ void chessposition::updateMultiPvTable(int pvindex, uint32_t mc)
 
 void chessposition::updatePvTable(uint32_t mc, bool recursive)
 {
-    pvtable[ply][0] = mc;
+    pvline(ply)[0] = mc;
     int i = 0;
     if (recursive)
     {
-        while (pvtable[ply + 1][i])
+        while (pvline(ply + 1)[i])
         {
-            pvtable[ply][i + 1] = pvtable[ply + 1][i];
+            pvline(ply)[i + 1] = pvline(ply + 1)[i];
             i++;
         }
     }
-    pvtable[ply][i + 1] = 0;
+    pvline(ply)[i + 1] = 0;
 }
 
 string chessposition::getPv(uint32_t *table)
@@ -1214,9 +1238,8 @@ void chessposition::pvdebugout()
 
 #endif
 
-// shameless copy from http://chessprogramming.wikispaces.com/Magic+Bitboards#Plain
-alignas(64) U64 mBishopAttacks[64][1 << BISHOPINDEXBITS];
-alignas(64) U64 mRookAttacks[64][1 << ROOKINDEXBITS];
+// shameless copy from http://chessprogramming.wikispaces.com/Magic+Bitboards#Fancy
+alignas(64) U64 mSliderAttacks[BISHOPTABLESIZE + ROOKTABLESIZE];
 
 alignas(64) SMagic mBishopTbl[64];
 alignas(64) SMagic mRookTbl[64];
@@ -1286,26 +1309,27 @@ U64 getMagicCandidate(U64 mask)
 #endif
 
 // Use precalculated macigs for better to save time at startup
+// The magics map to 2^(relevant squares) entries, so the shift depends on the square
 const U64 bishopmagics[] = {
-    0x1002004102008200, 0x1002004102008200, 0x4310002248214800, 0x402010c110014208, 0xa000a06240114001, 0xa000a06240114001, 0x402010c110014208, 0xa000a06240114001,
-    0x1002004102008200, 0x1002004102008200, 0x1002004102008200, 0x1002004102008200, 0x100c009840001000, 0x4310002248214800, 0xa000a06240114001, 0x4310002248214800,
-    0x4310002248214800, 0x822143005020a148, 0x0001901c00420040, 0x0880504024308060, 0x0100201004200002, 0xa000a06240114001, 0x822143005020a148, 0x1002004102008200,
-    0x1002004102008200, 0x1002004102008200, 0x1002004102008200, 0x2008080100820102, 0x1481010004104010, 0x0002052000100024, 0xc880221002060081, 0xc880221002060081,
-    0x4310002248214800, 0xc880221002060081, 0x0001901c00420040, 0x8400208020080201, 0x000e008400060020, 0x00449210e3902028, 0x402010c110014208, 0xc880221002060081,
-    0x100c009840001000, 0xc880221002060081, 0x1000820800c00060, 0x2803101084008800, 0x2200608200100080, 0x0040900130840090, 0x0024010008800a00, 0x0400110410804810,
-    0x402010c110014208, 0xa000a06240114001, 0xa000a06240114001, 0x1002004102008200, 0x1002004102008200, 0x1002004102008200, 0x1002004102008200, 0x1002004102008200,
-    0xa000a06240114001, 0x4310002248214800, 0x1002004102008200, 0x1002004102008200, 0x1002004102008200, 0x1002004102008200, 0x1002004102008200, 0x1002004102008200
+    0x1032083004294040, 0x6008081100620102, 0x2048048c05808800, 0x1004242481010020, 0x1030882000008480, 0x0212482014010802, 0x000200b068084000, 0x0002014104016090,
+    0xa000402411020204, 0x82c2101040810040, 0x2080108090810000, 0x0188041042004000, 0x4409240308100000, 0x12100c2260100029, 0x000014040c222842, 0x8001003101082000,
+    0x2040020811012200, 0x2204008801141c04, 0x5110000804902008, 0x0208041082014049, 0x0010809408a00109, 0x4010e0c210100809, 0x0020800104304200, 0x80a840282c040400,
+    0x0090051028281011, 0x0044202002020404, 0x0100300208004540, 0x2008080100820102, 0x1481010004104010, 0xc010009002080400, 0x3008244841140210, 0x0001013200440c00,
+    0x0201882011400430, 0x1801101830033810, 0x0200104800100080, 0x8400208020080201, 0x000e008400060020, 0x08c8080108029000, 0x2602240100440080, 0x2209020484052424,
+    0x0801082016003100, 0x8042120202012000, 0x0111002288401000, 0x01a00d4010400200, 0xc000010124000600, 0x8401411003028180, 0x930404108c000201, 0x0010010200906020,
+    0x050a0a1002288040, 0x20148c0118220140, 0x4080004200901000, 0x8220002042020028, 0x0400082020510110, 0x4028a1121a1a0004, 0x0488c20822440506, 0x0002101115090080,
+    0x0400220050041000, 0x080230410410a202, 0x800001204c040410, 0x0000000002104400, 0x0001202408a10102, 0x0000001020010106, 0x0900a00801010420, 0x1022a00405220020
 };
 
 const U64 rookmagics[] = {
-    0x8200108041020020, 0x8200108041020020, 0xc880221002060081, 0x0009100804021000, 0x0500010004107800, 0x0024010008800a00, 0x0400110410804810, 0x8300038100004222,
-    0x004a800182c00020, 0x0009100804021000, 0x3002200010c40021, 0x0020100104000208, 0x01021001a0080020, 0x0884020010082100, 0x1000820800c00060, 0x8020480110020020,
-    0x0002052000100024, 0x0200190040088100, 0x0030802001a00800, 0x8010002004000202, 0x0040010100080010, 0x2200608200100080, 0x0001901c00420040, 0x0001400a24008010,
-    0x1400a22008001042, 0x8200108041020020, 0x2004500023002400, 0x8105100028001048, 0x8010024d00014802, 0x8000820028030004, 0x402010c110014208, 0x8300038100004222,
-    0x0001804002800124, 0x0084022014041400, 0x0030802001a00800, 0x0110a01001080008, 0x0b10080850081100, 0x000010040049020c, 0x0024010008800a00, 0x014c800040100426,
-    0x1100400010208000, 0x0009100804021000, 0x0010024871202002, 0x8014001028c80801, 0x1201082010a00200, 0x0002008004102009, 0x8300038100004222, 0x0000401001a00408,
-    0x4520920010210200, 0x0400110410804810, 0x8105100028001048, 0x8105100028001048, 0x0802801009083002, 0x8200108041020020, 0x8200108041020020, 0x4000a12400848110,
-    0x2000804026001102, 0x2000804026001102, 0x800040a010040901, 0x80001802002c0422, 0x0010b018200c0122, 0x200204802a080401, 0x8880604201100844, 0x80000cc281092402
+    0x8200108041020020, 0x8200108041020020, 0x0880100408802000, 0x1280041002080080, 0x8200080410200200, 0x1080040002000180, 0x0200080140840200, 0x8300038100004222,
+    0x004a800182c00020, 0x0931401000200040, 0x002b802000801004, 0x4001001000210008, 0x8210808044004800, 0x0010800200c40080, 0x3004002c4a410810, 0x2002000104008042,
+    0x0406648000400190, 0xe800404000201008, 0x0050002004002800, 0x8014808010040800, 0x0008008080080400, 0x1001010004000802, 0x9000040010080102, 0x0080020021108044,
+    0x4080004440002004, 0x42100241c0012000, 0x0012001200408022, 0x0922000a00402010, 0xc0410011002801c4, 0x0202000200081004, 0x0010300400491208, 0x00000c0200006891,
+    0x0001804002800124, 0x1080200040401000, 0x4400801000802000, 0x03900400c2400800, 0x0200100501000800, 0x2702000401010008, 0x0000081054000201, 0x20b0809122000044,
+    0x0800800040008028, 0x0050002000404000, 0x0080802042020010, 0x00081022000a0040, 0x0080040008008080, 0x4802000410020008, 0x1100410832040010, 0x22030083510a0004,
+    0x2000210080104100, 0x0000400020008080, 0x4002201082420a00, 0x1008008010000880, 0x810008001c008180, 0x0240040002008080, 0x0010080201100400, 0x0120104421008200,
+    0x2000804026001102, 0x2000804026001102, 0x1083200211008a41, 0x9001002010008489, 0x2901000800500205, 0x020900020814002d, 0x340062080081500c, 0x80000cc281092402
 };
 
 
@@ -1313,6 +1337,8 @@ void initBitmaphelper()
 {
     int to;
     initPsqtable();
+    initMaterialtable();
+    U64 *sliderattacks = mSliderAttacks;
     for (int from = 0; from < 64; from++)
     {
         king_attacks[from] = knight_attacks[from] = 0ULL;
@@ -1449,26 +1475,34 @@ void initBitmaphelper()
 
         // mBishopTbl[from].magic = getMagicCandidate(mBishopTbl[from].mask);
         mBishopTbl[from].magic = bishopmagics[from];
+        int bits = POPCOUNT(mBishopTbl[from].mask);
+        mBishopTbl[from].shift = 64 - bits;
+        mBishopTbl[from].attacks = sliderattacks;
+        sliderattacks += (1ULL << bits);
 
-        for (int j = 0; j < (1 << BISHOPINDEXBITS); j++) {
+        for (int j = 0; j < (1 << bits); j++) {
             // First get the subset of mask corresponding to j
             U64 occ = getOccupiedFromMBIndex(j, mBishopTbl[from].mask);
             // Now get the attack bitmap for this subset and store to attack table
             U64 attack = (getAttacks(from, occ, -7) | getAttacks(from, occ, 7) | getAttacks(from, occ, -9) | getAttacks(from, occ, 9));
             int hashindex = BISHOPINDEX(occ, from);
-            mBishopAttacks[from][hashindex] = attack;
+            mBishopTbl[from].attacks[hashindex] = attack;
         }
 
         // mRookTbl[from].magic = getMagicCandidate(mRookTbl[from].mask);
         mRookTbl[from].magic = rookmagics[from];
+        bits = POPCOUNT(mRookTbl[from].mask);
+        mRookTbl[from].shift = 64 - bits;
+        mRookTbl[from].attacks = sliderattacks;
+        sliderattacks += (1ULL << bits);
 
-        for (int j = 0; j < (1 << ROOKINDEXBITS); j++) {
+        for (int j = 0; j < (1 << bits); j++) {
             // First get the subset of mask corresponding to j
             U64 occ = getOccupiedFromMBIndex(j, mRookTbl[from].mask);
             // Now get the attack bitmap for this subset and store to attack table
             U64 attack = (getAttacks(from, occ, -1) | getAttacks(from, occ, 1) | getAttacks(from, occ, -8) | getAttacks(from, occ, 8));
             int hashindex = ROOKINDEX(occ, from);
-            mRookAttacks[from][hashindex] = attack;
+            mRookTbl[from].attacks[hashindex] = attack;
         }
 
         epthelper[from] = 0ULL;
@@ -1530,9 +1564,10 @@ void chessposition::BitboardPrint(U64 b)
 }
 
 
-bool chessposition::playMove(chessmove *cm)
+template <int Me> bool chessposition::playMove(chessmove *cm)
 {
-    int s2m = state & S2MMASK;
+    PROFILESCOPE(PROF_PLAYMOVE);
+    const int s2m = Me;
     int eptnew = 0;
     int oldcastle = (state & CASTLEMASK);
 
@@ -1682,7 +1717,9 @@ bool chessposition::playMove(chessmove *cm)
             kingpos[s2m] = to;
 
         // Here we can test the move for being legal
-        if (isAttacked(kingpos[s2m], s2m))
+        // Only evasions, king moves, ep captures and moves of pinned pieces can leave the own king in check
+        if ((isCheckbb || ptype == KING || (ept && to == ept && ptype == PAWN) || (kingPinned & BITSET(from)))
+            && isAttacked(kingpos[s2m], s2m))
         {
             // Move is illegal; just do the necessary subset of unplayMove
             hash = movestack[mstop].hash;
@@ -1731,8 +1768,10 @@ bool chessposition::playMove(chessmove *cm)
         }
     }
 
-    PREFETCH(&mtrlhsh.table[materialhash & MATERIALHASHMASK]);
-    PREFETCH(&pwnhsh.table[pawnhash & pwnhsh.sizemask]);
+    if (sphsh)
+        PREFETCH(&sphsh->table[pawnhash & sphsh->sizemask]);
+    else
+        PREFETCH(&pwnhsh.table[pawnhash & pwnhsh.sizemask]);
 
     state ^= S2MMASK;
     isCheckbb = isAttackedBy<OCCUPIED>(kingpos[s2m ^ S2MMASK], s2m);
@@ -1764,8 +1803,9 @@ bool chessposition::playMove(chessmove *cm)
 }
 
 
-void chessposition::unplayMove(chessmove *cm)
+template <int Me> void chessposition::unplayMove(chessmove *cm)
 {
+    PROFILESCOPE(PROF_UNPLAYMOVE);
     ply--;
     mstop--;
     myassert(mstop >= 0, this, 1, mstop);
@@ -1781,9 +1821,8 @@ void chessposition::unplayMove(chessmove *cm)
         int cstli = GETCASTLEINDEX(cm->code);
         int kingto = castlekingto[cstli];
         int rookto = castlerookto[cstli];
-        int s2m = cstli / 2;
-        PieceCode kingpc = (PieceCode)(WKING | s2m);
-        PieceCode rookpc = (PieceCode)(WROOK | s2m);
+        PieceCode kingpc = (PieceCode)(WKING | Me);
+        PieceCode rookpc = (PieceCode)(WROOK | Me);
 
         mailbox[kingto] = BLANK;
         mailbox[rookto] = BLANK;
@@ -1852,9 +1891,9 @@ inline void appendPromotionMove(chessposition *pos, chessmove **m, int from, int
 }
 
 
-template <PieceType Pt> int CreateMovelistPiece(chessposition *pos, chessmove* mstart, U64 occ, U64 targets, int me)
+template <PieceType Pt, int Me> int CreateMovelistPiece(chessposition *pos, chessmove* mstart, U64 occ, U64 targets)
 {
-    const PieceCode pc = (PieceCode)((Pt << 1) | me);
+    const PieceCode pc = (PieceCode)((Pt << 1) | Me);
     U64 frombits = pos->piece00[pc];
     U64 tobits = 0ULL;
     chessmove *m = mstart;
@@ -1881,8 +1920,9 @@ template <PieceType Pt> int CreateMovelistPiece(chessposition *pos, chessmove* m
 }
 
 
-inline int CreateMovelistCastle(chessposition *pos, chessmove* mstart, int me)
+template <int Me> inline int CreateMovelistCastle(chessposition *pos, chessmove* mstart)
 {
+    const int me = Me;
     if (pos->isCheckbb)
         return 0;
 
@@ -1920,10 +1960,11 @@ inline int CreateMovelistCastle(chessposition *pos, chessmove* mstart, int me)
 }
 
 
-template <MoveType Mt> inline int CreateMovelistPawn(chessposition *pos, chessmove* mstart, int me)
+template <MoveType Mt, int Me> inline int CreateMovelistPawn(chessposition *pos, chessmove* mstart)
 {
     chessmove *m = mstart;
-    int you = 1 - me;
+    const int me = Me;
+    const int you = Me ^ S2MMASK;
     const PieceCode pc = (PieceCode)(WPAWN | me);
     const U64 occ = pos->occupied00[0] | pos->occupied00[1];
     U64 frombits, tobits;
@@ -1998,11 +2039,11 @@ template <MoveType Mt> inline int CreateMovelistPawn(chessposition *pos, chessmo
 }
 
 
-int CreateEvasionMovelist(chessposition *pos, chessmove* mstart)
+template <int Me> int CreateEvasionMovelist(chessposition *pos, chessmove* mstart)
 {
     chessmove* m = mstart;
-    int me = pos->state & S2MMASK;
-    int you = me ^ S2MMASK;
+    const int me = Me;
+    const int you = Me ^ S2MMASK;
     U64 targetbits;
     U64 frombits;
     int from, to;
@@ -2080,9 +2121,18 @@ int CreateEvasionMovelist(chessposition *pos, chessmove* mstart)
 }
 
 
-template <MoveType Mt> int CreateMovelist(chessposition *pos, chessmove* mstart)
+int CreateEvasionMovelist(chessposition *pos, chessmove* mstart)
+{
+    PROFILESCOPE(PROF_MOVEGEN);
+    if (pos->state & S2MMASK)
+        return CreateEvasionMovelist<BLACK>(pos, mstart);
+    else
+        return CreateEvasionMovelist<WHITE>(pos, mstart);
+}
+
+
+template <MoveType Mt, int Me> int CreateMovelist(chessposition *pos, chessmove* mstart)
 {
-    int me = pos->state & S2MMASK;
     U64 occupiedbits = (pos->occupied00[0] | pos->occupied00[1]);
     U64 emptybits = ~occupiedbits;
     U64 targetbits = 0ULL;
@@ -2091,21 +2141,87 @@ template <MoveType Mt> int CreateMovelist(chessposition *pos, chessmove* mstart)
     if (Mt & QUIET)
         targetbits |= emptybits;
     if (Mt & CAPTURE)
-        targetbits |= pos->occupied00[me ^ S2MMASK];
-
-    m += CreateMovelistPawn<Mt>(pos, m, me);
-    m += CreateMovelistPiece<KNIGHT>(pos, m, occupiedbits, targetbits, me);
-    m += CreateMovelistPiece<BISHOP>(pos, m, occupiedbits, targetbits, me);
-    m += CreateMovelistPiece<ROOK>(pos, m, occupiedbits, targetbits, me);
-    m += CreateMovelistPiece<QUEEN>(pos, m, occupiedbits, targetbits, me);
-    m += CreateMovelistPiece<KING>(pos, m, occupiedbits, targetbits, me);
+        targetbits |= pos->occupied00[Me ^ S2MMASK];
+
+    m += CreateMovelistPawn<Mt, Me>(pos, m);
+    m += CreateMovelistPiece<KNIGHT, Me>(pos, m, occupiedbits, targetbits);
+    m += CreateMovelistPiece<BISHOP, Me>(pos, m, occupiedbits, targetbits);
+    m += CreateMovelistPiece<ROOK, Me>(pos, m, occupiedbits, targetbits);
+    m += CreateMovelistPiece<QUEEN, Me>(pos, m, occupiedbits, targetbits);
+    m += CreateMovelistPiece<KING, Me>(pos, m, occupiedbits, targetbits);
     if (Mt & QUIET)
-        m += CreateMovelistCastle(pos, m, me);
+        m += CreateMovelistCastle<Me>(pos, m);
 
     return (int)(m - mstart);
 }
 
 
+// Legal move generator; filters the pseudo-legal moves using the pins and the check evasion generator.
+// Only king moves and ep captures need a real test for attacks to the king.
+template <int Me> int CreateLegalMovelist(chessposition *pos, chessmove* mstart)
+{
+    const int You = Me ^ S2MMASK;
+    const int king = pos->kingpos[Me];
+    const U64 pinned = pos->kingPinned & pos->occupied00[Me];
+    int length = (pos->isCheckbb ? CreateEvasionMovelist<Me>(pos, mstart) : CreateMovelist<ALL, Me>(pos, mstart));
+    chessmove *m = mstart;
+
+    for (int i = 0; i < length; i++)
+    {
+        uint32_t code = mstart[i].code;
+        int from = GETFROM(code);
+        int to = GETTO(code);
+        if (from == king)
+        {
+            // castles and king evasions are already tested by the generators
+            if (!ISCASTLE(code) && !pos->isCheckbb && pos->isAttacked(to, Me))
+                continue;
+        }
+        else if (ISEPCAPTURE(code))
+        {
+            // the captured pawn and the capturing pawn may both block a slider
+            int epfield = (from & 0x38) | (to & 0x07);
+            U64 occ = (pos->occupied00[0] | pos->occupied00[1]) ^ BITSET(from) ^ BITSET(to) ^ BITSET(epfield);
+            if (pos->isAttackedByMySlider(king, occ, You))
+                continue;
+        }
+        else if ((pinned & BITSET(from)) && !(lineMask[king][from] & BITSET(to)))
+        {
+            // pinned pieces can only move along the pin
+            continue;
+        }
+        *m++ = mstart[i];
+    }
+
+    return (int)(m - mstart);
+}
+
+
+int CreateLegalMovelist(chessposition *pos, chessmove* mstart)
+{
+    if (pos->state & S2MMASK)
+        return CreateLegalMovelist<BLACK>(pos, mstart);
+    else
+        return CreateLegalMovelist<WHITE>(pos, mstart);
+}
+
+
+template <MoveType Mt> int CreateMovelist(chessposition *pos, chessmove* mstart)
+{
+    PROFILESCOPE(PROF_MOVEGEN);
+    // dispatch the side to move once; the generators are specialized on color
+    if (pos->state & S2MMASK)
+        return CreateMovelist<Mt, BLACK>(pos, mstart);
+    else
+        return CreateMovelist<Mt, WHITE>(pos, mstart);
+}
+
+// Explicit template instantiation; the dispatcher is inlined in this file but also used in others
+template int CreateMovelist<ALL>(chessposition *pos, chessmove* mstart);
+template int CreateMovelist<TACTICAL>(chessposition *pos, chessmove* mstart);
+template int CreateMovelist<QUIET>(chessposition *pos, chessmove* mstart);
+
+
 U64 chessposition::movesTo(PieceCode pc, int from)
 {
     PieceType p = (pc >> 1) ;
@@ -2207,6 +2323,7 @@ int chessposition::phase()
 // more advanced see respecting a variable threshold, quiet and promotion moves and faster xray attack handling
 bool chessposition::see(uint32_t move, int threshold)
 {
+    PROFILESCOPE(PROF_SEE);
     int from = GETFROM(move);
     int to = GETCORRECTTO(move);
 
@@ -2322,8 +2439,9 @@ void MoveSelector::SetPreferredMoves(chessposition *p)
         state = EVASIONINITSTATE;
         pos->getCmptr(&cmptr[0]);
     }
-    captures = &pos->captureslist[pos->ply];
-    quiets = &pos->quietslist[pos->ply];
+    plymovelists *lists = pos->movelists.get(pos->ply, false);
+    captures = &lists->captures;
+    quiets = &lists->quiets;
 }
 
 // MoveSelector for alphabeta search
@@ -2338,23 +2456,29 @@ void MoveSelector::SetPreferredMoves(chessposition *p, uint16_t hshm, uint32_t k
     if (counter != hashmove.code && counter != kllm1 && counter != kllm2)
         countermove.code = counter;
     pos->getCmptr(&cmptr[0]);
-    if (!excludemove)
-    {
-        captures = &pos->captureslist[pos->ply];
-        quiets = &pos->quietslist[pos->ply];
-    }
-    else
-    {
-        captures = &pos->singularcaptureslist[pos->ply];
-        quiets = &pos->singularquietslist[pos->ply];
-    }
+    // singular testing needs extra lists as the lists of the ply are still in use
+    plymovelists *lists = pos->movelists.get(pos->ply, excludemove);
+    captures = &lists->captures;
+    quiets = &lists->quiets;
     if (p->isCheckbb)
         state = EVASIONINITSTATE;
 }
 
 
+void movelistarena::remove()
+{
+    for (int i = 0; i < MAXDEPTH; i++)
+        for (int j = 0; j < 2; j++)
+        {
+            delete lists[i][j];
+            lists[i][j] = nullptr;
+        }
+}
+
+
 chessmove* MoveSelector::next()
 {
+    PROFILESCOPE(PROF_MOVESELECTOR);
     chessmove *m;
     switch (state)
     {
@@ -2434,7 +2558,8 @@ chessmove* MoveSelector::next()
             bool bBadTactical = (m->value & BADTACTICALFLAG);
             m->value = INT_MIN;
             if (bBadTactical) {
-                STATISTICSDO(if (m->code == hashmove.code) STATISTICSINC(moves_bad_hash));
+                if (en.SearchStatistics && m->code == hashmove.code)
+                    pos->statistics.moves_bad_hash++;
                 return m;
             }
         }
@@ -2491,6 +2616,31 @@ static void uciSetSyzygyPath()
     init_tablebases((char*)en.SyzygyPath.c_str());
 }
 
+static void uciSetClusterPort()
+{
+    cl.stop();
+    if (en.ClusterPort)
+        cl.startMaster(en.ClusterPort);
+}
+
+#ifdef SEARCHTRACE
+static void uciSetSearchTrace()
+{
+    strace.stop();
+    if (en.SearchTraceFile != "" && en.SearchTraceFile != "<empty>" && !strace.start(en.SearchTraceFile))
+        cout << "info string Cannot open trace file " << en.SearchTraceFile << "\n";
+}
+#endif
+
+static void uciSetTimeLog()
+{
+    if (en.timelog)
+        fclose(en.timelog);
+    en.timelog = nullptr;
+    if (en.TimeLogFile != "" && en.TimeLogFile != "<empty>" && !timeLogOpen(en.TimeLogFile))
+        cout << "info string Cannot open time log file " << en.TimeLogFile << "\n";
+}
+
 #ifdef NNUE
 static void uciSetNnuePath()
 {
@@ -2522,6 +2672,8 @@ engine::engine(compilerinfo *c)
     
     ucioptions.Register(&Threads, "Threads", ucispin, "1", 1, MAXTHREADS, uciSetThreads);  // order is important as the pawnhash depends on Threads > 0
     ucioptions.Register(&Hash, "Hash", ucispin, to_string(DEFAULTHASH), 1, MAXHASH, uciSetHash);
+    ucioptions.Register(&SharedPawnHash, "SharedPawnHash", ucicheck, "false", 0, 0, uciSetThreads);
+    ucioptions.Register(&smpMarking, "SMPMarking", ucicheck, "true");
     ucioptions.Register(&moveOverhead, "Move Overhead", ucispin, "50", 0, 5000, nullptr);
     ucioptions.Register(&MultiPV, "MultiPV", ucispin, "1", 1, MAXMULTIPV, nullptr);
     ucioptions.Register(&ponder, "Ponder", ucicheck, "false");
@@ -2529,7 +2681,14 @@ engine::engine(compilerinfo *c)
     ucioptions.Register(&Syzygy50MoveRule, "Syzygy50MoveRule", ucicheck, "true");
     ucioptions.Register(&SyzygyProbeLimit, "SyzygyProbeLimit", ucispin, "7", 0, 7, nullptr);
     ucioptions.Register(&chess960, "UCI_Chess960", ucicheck, "false");
+    ucioptions.Register(&SearchStatistics, "SearchStatistics", ucicheck, "false");
     ucioptions.Register(nullptr, "Clear Hash", ucibutton, "", 0, 0, uciClearHash);
+    ucioptions.Register(&ClusterPort, "ClusterPort", ucispin, "0", 0, 65535, uciSetClusterPort);
+    ucioptions.Register(&ClusterHost, "ClusterHost", ucistring, "<empty>", 0, 0, uciSetClusterPort);
+#ifdef SEARCHTRACE
+    ucioptions.Register(&SearchTraceFile, "SearchTraceFile", ucistring, "<empty>", 0, 0, uciSetSearchTrace);
+#endif
+    ucioptions.Register(&TimeLogFile, "TimeLogFile", ucistring, "<empty>", 0, 0, uciSetTimeLog);
 #ifdef NNUE
     ucioptions.Register(&NnueNetpath, "NNUENetpath", ucistring, "./default.nnue", 0, 0, uciSetNnuePath);
 #endif
@@ -2545,10 +2704,10 @@ engine::engine(compilerinfo *c)
 engine::~engine()
 {
     ucioptions.Set("SyzygyPath", "<empty>");
+    ucioptions.Set("TimeLogFile", "<empty>");
     Threads = 0;
     allocThreads();
     rootposition.pwnhsh.remove();
-    rootposition.mtrlhsh.remove();
 #ifdef NNUE
     NnueRemove();
 #endif
@@ -2557,14 +2716,16 @@ engine::~engine()
 
 void engine::allocThreads()
 {
-    // first cleanup the old searchthreads memory
+    // first stop the old search threads and cleanup their memory
+    removeSearchThreads();
     for (int i = 0; i < oldThreads; i++)
     {
-        sthread[i].pos.mtrlhsh.remove();
         sthread[i].pos.pwnhsh.remove();
+        sthread[i].pos.movelists.remove();
     }
 
     freealigned64(sthread);
+    sph.remove();
 
     oldThreads = Threads;
 
@@ -2576,16 +2737,45 @@ void engine::allocThreads()
 
     sthread = (searchthread*) allocalign64(size);
     memset((void*)sthread, 0, size);
+    if (SharedPawnHash)
+        // one table for all threads with compact entries; no need to shrink it with growing number of threads
+        sph.setSize(min(128, max(16, restSizeOfTp)));
     for (int i = 0; i < Threads; i++)
     {
         sthread[i].index = i;
         sthread[i].searchthreads = sthread;
         sthread[i].numofthreads = Threads;
-        sthread[i].pos.pwnhsh.setSize(sizeOfPh);
-        sthread[i].pos.mtrlhsh.init();
+        if (SharedPawnHash)
+            sthread[i].pos.sphsh = &sph;
+        else
+            sthread[i].pos.pwnhsh.setSize(sizeOfPh);
     }
     prepareThreads();
     resetStats();
+    createSearchThreads();
+}
+
+
+size_t engine::getMemoryUsage(bool verbose)
+{
+    size_t ttsize = tp.size * sizeof(transpositioncluster);
+    size_t threadsize = oldThreads * sizeof(searchthread);
+    size_t phsize = sph.sizeInBytes;
+    size_t mhsize = sizeof(materialtable);
+    if (rootposition.pwnhsh.table)
+        phsize += (rootposition.pwnhsh.sizemask + 1) * sizeof(S_PAWNHASHENTRY);
+    for (int i = 0; i < oldThreads; i++)
+    {
+        if (sthread[i].pos.pwnhsh.table)
+            phsize += (sthread[i].pos.pwnhsh.sizemask + 1) * sizeof(S_PAWNHASHENTRY);
+    }
+    size_t total = ttsize + threadsize + phsize + mhsize;
+
+    if (verbose)
+        send("info string Memory usage: %d MB (hash %d MB, %s pawn hash %d MB, material table %d MB, threads %d MB)\n",
+            (int)(total >> 20), (int)(ttsize >> 20), SharedPawnHash ? "shared" : "per thread", (int)(phsize >> 20), (int)(mhsize >> 20), (int)(threadsize >> 20));
+
+    return total;
 }
 
 
@@ -2595,12 +2785,12 @@ void engine::prepareThreads()
     {
         chessposition *pos = &sthread[i].pos;
         // copy new position to the threads copy but keep old history data
-        memcpy((void*)pos, &rootposition, offsetof(chessposition, history));
+        pos->copyRootState(&rootposition);
         pos->threadindex = i;
         // early reset of variables that are important for bestmove selection
         pos->bestmovescore[0] = NOSCORE;
         pos->bestmove.code = 0;
-        pos->nodes = 0;
+        pos->counters.nodes = 0;
         pos->nullmoveply = 0;
         pos->nullmoveside = 0;
         pos->accumulator->computationState = false;
@@ -2608,6 +2798,17 @@ void engine::prepareThreads()
 }
 
 
+// Copy board and root state of src; of the search stacks only the part up to the root is copied
+void chessposition::copyRootState(chessposition *src)
+{
+    memcpy((void*)this, src, offsetof(chessposition, movestack));
+    memcpy(movestack, src->movestack, min(mstop + 1, MAXDEPTH) * sizeof(chessmovestack));
+    excludemovestack[mstop] = 0;
+    memset(LegalMoves, 0, sizeof(LegalMoves));
+    memset(killer, 0, sizeof(killer));
+}
+
+
 void chessposition::resetStats()
 {
     memset(history, 0, sizeof(chessposition::history));
@@ -2634,12 +2835,22 @@ U64 engine::getTotalNodes()
 {
     U64 nodes = 0;
     for (int i = 0; i < Threads; i++)
-        nodes += sthread[i].pos.nodes;
+        nodes += sthread[i].pos.counters.nodes.load(memory_order_relaxed);
 
     return nodes;
 }
 
 
+U64 engine::getTotalTbhits()
+{
+    U64 tbhits = 0;
+    for (int i = 0; i < Threads; i++)
+        tbhits += sthread[i].pos.counters.tbhits.load(memory_order_relaxed);
+
+    return tbhits;
+}
+
+
 void engine::communicate(string inputstring)
 {
     string fen = STARTFEN;
@@ -2651,6 +2862,7 @@ void engine::communicate(string inputstring)
     bool bGetName, bGetValue;
     string sName, sValue;
     bool bMoves;
+    size_t memoryUsage;
     bool pendingisready = false;
     bool pendingposition = (inputstring == "");
     do
@@ -2682,6 +2894,14 @@ void engine::communicate(string inputstring)
                 rootposition.getRootMoves();
                 rootposition.tbFilterRootMoves();
                 prepareThreads();
+                if (cl.enabled)
+                {
+                    // forward the position to the workers of the cluster
+                    string clustercmd = "position fen " + fen + " moves";
+                    for (vector<string>::iterator it = moves.begin(); it != moves.end(); ++it)
+                        clustercmd += " " + *it;
+                    cl.sendCommand(clustercmd);
+                }
                 if (debug)
                 {
                     rootposition.print();
@@ -2754,13 +2974,15 @@ void engine::communicate(string inputstring)
                 tp.clean();
                 resetStats();
                 sthread[0].pos.lastbestmovescore = NOSCORE;
+                cl.sendCommand("ucinewgame");
                 break;
             case SETOPTION:
                 if (en.stopLevel != ENGINETERMINATEDSEARCH)
                 {
-                    send("info string Changing option while searching is not supported. stopLevel = %d\n", en.stopLevel);
+                    send("info string Changing option while searching is not supported. stopLevel = %d\n", en.stopLevel.load());
                     break;
                 }
+                memoryUsage = getMemoryUsage();
                 bGetName = bGetValue = false;
                 sName = sValue = "";
                 while (ci < cs)
@@ -2796,6 +3018,8 @@ void engine::communicate(string inputstring)
                     ci++;
                 }
                 ucioptions.Set(sName, sValue);
+                if (getMemoryUsage() != memoryUsage)
+                    getMemoryUsage(true);
                 break;
             case ISREADY:
                 pendingisready = true;
@@ -2932,6 +3156,20 @@ void engine::communicate(string inputstring)
                     cout << perft(maxdepth, false) << "\n";
                 }
                 break;
+#ifdef PROFILING
+            case PROFILE:
+                if (ci < cs && commandargs[ci] == "reset")
+                    profileReset();
+                else
+                    profilePrint(stdout);
+                break;
+#endif
+            case DIVIDE:
+                if (ci < cs) {
+                    maxdepth = stoi(commandargs[ci++]);
+                    cout << "Nodes: " << perft(maxdepth, false, true) << "\n";
+                }
+                break;
 #ifdef EVALTUNE
             case TUNE:
                 parseTune(commandargs);
@@ -3108,4 +3346,8 @@ template U64 chessposition::pieceMovesTo<ROOK>(int);
 template U64 chessposition::pieceMovesTo<QUEEN>(int);
 template bool chessposition::sliderAttacked<WHITE>(int index, U64 occ);
 template bool chessposition::sliderAttacked<BLACK>(int index, U64 occ);
+template bool chessposition::playMove<WHITE>(chessmove *cm);
+template bool chessposition::playMove<BLACK>(chessmove *cm);
+template void chessposition::unplayMove<WHITE>(chessmove *cm);
+template void chessposition::unplayMove<BLACK>(chessmove *cm);
 
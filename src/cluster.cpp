@@ -0,0 +1,532 @@
+/*
+  RubiChess is a UCI chess playing engine by Andreas Matthies.
+
+  RubiChess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  RubiChess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "RubiChess.h"
+
+//
+// Cluster mode: Lazy SMP across processes
+// The master (rank 0) talks to the GUI and accepts workers on ClusterPort.
+// Workers are started with -clusterworker host:port, get the position and an infinite go from the master
+// and search until the master stops them. All processes exchange their deep tt entries and the workers
+// report every finished iteration so the master can pick the best result like it does for its threads.
+// The master listens on the loopback interface unless ClusterHost names the address to listen on.
+//
+
+#ifndef _WIN32
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+struct clustermessageheader {
+    uint32_t type;
+    uint32_t length;
+};
+
+struct clusterhello {
+    uint32_t magic;
+    uint32_t maxnodes;
+};
+
+
+static bool sendAll(int sock, const void *data, size_t length)
+{
+    const char *p = (const char*)data;
+    while (length)
+    {
+        ssize_t n = send(sock, p, length, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+
+static bool recvAll(int sock, void *data, size_t length)
+{
+    char *p = (char*)data;
+    while (length)
+    {
+        ssize_t n = recv(sock, p, length, 0);
+        if (n <= 0)
+            return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+
+static bool recvMessage(int sock, uint32_t *type, vector<char> *data)
+{
+    clustermessageheader header;
+    if (!recvAll(sock, &header, sizeof(header)))
+        return false;
+    if (header.length > CLUSTERMAXMESSAGE)
+        return false;
+    *type = header.type;
+    data->resize(header.length);
+    return (!header.length || recvAll(sock, data->data(), header.length));
+}
+
+
+bool Cluster::sendMessage(int peer, uint32_t type, const void *data, uint32_t length)
+{
+    clustermessageheader header = { type, length };
+    lock_guard<mutex> lock(sendmutex);
+    int sock = socks[peer];
+    return sock >= 0 && sendAll(sock, &header, sizeof(header)) && (!length || sendAll(sock, data, length));
+}
+
+
+void Cluster::broadcast(uint32_t type, const void *data, uint32_t length, int exceptpeer)
+{
+    int n = numsocks;
+    for (int i = 0; i < n; i++)
+        if (i != exceptpeer && socks[i] >= 0)
+            sendMessage(i, type, data, length);
+}
+
+
+bool Cluster::startMaster(int listenport)
+{
+    listensock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listensock < 0)
+    {
+        listensock = 0;
+        return false;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)listenport);
+    if (en.ClusterHost != "" && en.ClusterHost != "<empty>")
+    {
+        addrinfo hints, *ai;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(en.ClusterHost.c_str(), nullptr, &hints, &ai) != 0)
+        {
+            printf("info string Cluster host %s not found.\n", en.ClusterHost.c_str());
+            close(listensock);
+            listensock = 0;
+            return false;
+        }
+        addr.sin_addr = ((sockaddr_in*)ai->ai_addr)->sin_addr;
+        freeaddrinfo(ai);
+    }
+
+    int yes = 1;
+    setsockopt(listensock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    socklen_t addrlen = sizeof(addr);
+    if (::bind(listensock, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listensock, CLUSTERMAXNODES) < 0
+        || getsockname(listensock, (sockaddr*)&addr, &addrlen) < 0)
+    {
+        close(listensock);
+        listensock = 0;
+        return false;
+    }
+
+    port = ntohs(addr.sin_port);
+    rank = 0;
+    numsocks = 0;
+    terminating = false;
+    acceptthr = thread(&Cluster::acceptLoop, this);
+    flushthr = thread(&Cluster::flushLoop, this);
+    printf("info string Cluster master listening on port %d\n", port);
+    return true;
+}
+
+
+void Cluster::acceptLoop()
+{
+    while (!terminating)
+    {
+        int sock = accept(listensock, nullptr, nullptr);
+        if (sock < 0)
+            continue;
+        if (terminating || numsocks >= CLUSTERMAXNODES - 1 || !acceptHandshake(sock))
+        {
+            close(sock);
+            continue;
+        }
+        int yes = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        int peer = numsocks;
+        socks[peer] = sock;
+        {
+            lock_guard<mutex> lock(resultmutex);
+            results[peer].searchnum = -1;
+        }
+        receivethr[peer] = thread(&Cluster::receiveLoop, this, peer);
+        // publish the new peer to the sending threads
+        numsocks = peer + 1;
+        enabled = true;
+        printf("info string Cluster worker %d connected\n", peer + 1);
+    }
+}
+
+
+// The first message of a new peer has to be a valid hello within CLUSTERHANDSHAKEMS
+bool Cluster::acceptHandshake(int sock)
+{
+    timeval tv = { CLUSTERHANDSHAKEMS / 1000, (CLUSTERHANDSHAKEMS % 1000) * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    uint32_t type;
+    vector<char> data;
+    if (!recvMessage(sock, &type, &data) || type != CLUSTERHELLO || data.size() != sizeof(clusterhello))
+        return false;
+    clusterhello *hello = (clusterhello*)data.data();
+    if (hello->magic != CLUSTERMAGIC || hello->maxnodes != CLUSTERMAXNODES)
+        return false;
+    tv = { 0, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return true;
+}
+
+
+bool Cluster::startWorker(string hostport)
+{
+    size_t colon = hostport.rfind(':');
+    if (colon == string::npos)
+        return false;
+    string host = hostport.substr(0, colon);
+    string service = hostport.substr(colon + 1);
+
+    addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &ai) != 0)
+        return false;
+
+    int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    bool connected = (sock >= 0 && connect(sock, ai->ai_addr, ai->ai_addrlen) == 0);
+    freeaddrinfo(ai);
+    if (!connected)
+    {
+        if (sock >= 0)
+            close(sock);
+        return false;
+    }
+
+    int yes = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    clusterhello hello = { CLUSTERMAGIC, CLUSTERMAXNODES };
+    clustermessageheader header = { CLUSTERHELLO, (uint32_t)sizeof(hello) };
+    if (!sendAll(sock, &header, sizeof(header)) || !sendAll(sock, &hello, sizeof(hello)))
+    {
+        close(sock);
+        return false;
+    }
+
+    rank = 1;
+    socks[0] = sock;
+    numsocks = 1;
+    searchnum = -1;
+    terminating = false;
+    enabled = true;
+    flushthr = thread(&Cluster::flushLoop, this);
+    return true;
+}
+
+
+// Main loop of a worker process; executes the commands of the master
+void Cluster::workerLoop()
+{
+    uint32_t type;
+    vector<char> data;
+    thread searchthr;
+    atomic<bool> searchdone(true);
+
+    while (recvMessage(socks[0], &type, &data))
+    {
+        if (type == CLUSTERTT)
+        {
+            mergeHash((clusterttentry*)data.data(), (int)(data.size() / sizeof(clusterttentry)));
+            continue;
+        }
+        if (type == CLUSTERGO && data.size() < sizeof(int32_t))
+            continue;
+        if (type != CLUSTERCOMMAND && type != CLUSTERGO)
+            continue;
+
+        // a go carries the searchnum of the master which is echoed with the results
+        int32_t mastersearchnum = 0;
+        size_t cmdstart = 0;
+        if (type == CLUSTERGO)
+        {
+            memcpy(&mastersearchnum, data.data(), sizeof(int32_t));
+            cmdstart = sizeof(int32_t);
+        }
+        string cmd(data.begin() + cmdstart, data.end());
+
+        // every command stops a running search; repeat as the search thread could still be starting
+        while (!searchdone)
+        {
+            if (en.stopLevel < ENGINESTOPIMMEDIATELY)
+                en.stopLevel = ENGINESTOPIMMEDIATELY;
+            Sleep(1);
+        }
+        if (searchthr.joinable())
+            searchthr.join();
+
+        if (cmd == "quit")
+            break;
+        if (type == CLUSTERGO)
+        {
+            searchnum = mastersearchnum;
+            searchdone = false;
+            searchthr = thread([cmd, &searchdone]() { en.communicate(cmd); searchdone = true; });
+        }
+        else if (cmd != "stop")
+        {
+            en.communicate(cmd);
+        }
+    }
+
+    while (!searchdone)
+    {
+        en.stopLevel = ENGINESTOPIMMEDIATELY;
+        Sleep(1);
+    }
+    if (searchthr.joinable())
+        searchthr.join();
+    stop();
+}
+
+
+void Cluster::receiveLoop(int peer)
+{
+    uint32_t type;
+    vector<char> data;
+
+    while (recvMessage(socks[peer], &type, &data))
+    {
+        if (type == CLUSTERTT)
+        {
+            // merge into our table and pass them to the other workers
+            mergeHash((clusterttentry*)data.data(), (int)(data.size() / sizeof(clusterttentry)));
+            broadcast(CLUSTERTT, data.data(), (uint32_t)data.size(), peer);
+        }
+        else if (type == CLUSTERRESULT && data.size() <= sizeof(clusterresult))
+        {
+            lock_guard<mutex> lock(resultmutex);
+            memset(&results[peer], 0, sizeof(clusterresult));
+            memcpy(&results[peer], data.data(), data.size());
+        }
+    }
+
+    if (terminating)
+        return;
+
+    // mark the peer dead; wait for a running send to this socket before closing it
+    int sock;
+    {
+        lock_guard<mutex> lock(sendmutex);
+        sock = socks[peer].exchange(-1);
+    }
+    if (sock >= 0)
+        close(sock);
+    {
+        lock_guard<mutex> lock(resultmutex);
+        results[peer].searchnum = -1;
+    }
+    printf("info string Cluster worker %d disconnected\n", peer + 1);
+}
+
+
+void Cluster::flushLoop()
+{
+    vector<clusterttentry> entries;
+    while (!terminating)
+    {
+        Sleep(CLUSTERFLUSHMS);
+        {
+            lock_guard<mutex> lock(queuemutex);
+            entries.swap(ttqueue);
+        }
+        const size_t chunk = CLUSTERMAXMESSAGE / sizeof(clusterttentry);
+        for (size_t i = 0; i < entries.size(); i += chunk)
+        {
+            size_t num = min(chunk, entries.size() - i);
+            broadcast(CLUSTERTT, entries.data() + i, (uint32_t)(num * sizeof(clusterttentry)));
+        }
+        entries.clear();
+    }
+}
+
+
+void Cluster::mergeHash(clusterttentry *e, int num)
+{
+    for (int i = 0; i < num; i++, e++)
+        tp.addHash(e->hash, e->value, e->staticeval, e->bound, e->depth, e->movecode, false);
+}
+
+
+void Cluster::queueHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode)
+{
+    clusterttentry e = { hash, (int16_t)val, staticeval, movecode, (uint8_t)depth, (uint8_t)bound };
+    lock_guard<mutex> lock(queuemutex);
+    ttqueue.push_back(e);
+}
+
+
+void Cluster::sendCommand(string cmd)
+{
+    if (!enabled || rank)
+        return;
+    if (cmd.compare(0, 2, "go") == 0)
+    {
+        // send our searchnum with the go so the workers report their results for this search
+        searchnum++;
+        vector<char> data(sizeof(int32_t) + cmd.length());
+        int32_t sn = searchnum;
+        memcpy(data.data(), &sn, sizeof(int32_t));
+        memcpy(data.data() + sizeof(int32_t), cmd.c_str(), cmd.length());
+        broadcast(CLUSTERGO, data.data(), (uint32_t)data.size());
+        return;
+    }
+    broadcast(CLUSTERCOMMAND, cmd.c_str(), (uint32_t)cmd.length());
+}
+
+
+void Cluster::sendResult(int depth, int score, uint32_t *pv)
+{
+    clusterresult r;
+    r.searchnum = searchnum;
+    r.depth = depth;
+    r.score = score;
+    int i = 0;
+    while (pv[i] && i < MAXDEPTH - 1)
+    {
+        r.pv[i] = pv[i];
+        i++;
+    }
+    r.pv[i++] = 0;
+    sendMessage(0, CLUSTERRESULT, &r, (uint32_t)(offsetof(clusterresult, pv) + i * sizeof(uint32_t)));
+}
+
+
+// Get the result of a worker that finished at least mindepth with a score better than minscore
+bool Cluster::getBestResult(int mindepth, int minscore, clusterresult *result)
+{
+    bool found = false;
+    lock_guard<mutex> lock(resultmutex);
+    int n = numsocks;
+    for (int i = 0; i < n; i++)
+    {
+        clusterresult *r = &results[i];
+        if (r->searchnum == searchnum && r->pv[0] && r->depth >= mindepth && r->score > minscore)
+        {
+            mindepth = r->depth;
+            minscore = r->score;
+            *result = *r;
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+void Cluster::stop()
+{
+    if (!enabled && listensock <= 0 && !flushthr.joinable())
+        return;
+
+    if (rank == 0)
+        broadcast(CLUSTERCOMMAND, "quit", 4);
+    terminating = true;
+    enabled = false;
+    if (listensock > 0)
+    {
+        shutdown(listensock, SHUT_RDWR);
+        close(listensock);
+        listensock = 0;
+    }
+    if (acceptthr.joinable())
+        acceptthr.join();
+    // the accept thread is gone so the peer table doesn't change anymore
+    int n = numsocks;
+    {
+        lock_guard<mutex> lock(sendmutex);
+        for (int i = 0; i < n; i++)
+            if (socks[i] >= 0)
+                shutdown(socks[i], SHUT_RDWR);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (receivethr[i].joinable())
+            receivethr[i].join();
+        int sock = socks[i].exchange(-1);
+        if (sock >= 0)
+            close(sock);
+    }
+    numsocks = 0;
+    if (flushthr.joinable())
+        flushthr.join();
+    ttqueue.clear();
+}
+
+#else // _WIN32
+
+bool Cluster::startMaster(int listenport)
+{
+    (void)listenport;
+    printf("info string Cluster mode is not supported on Windows.\n");
+    return false;
+}
+
+bool Cluster::acceptHandshake(int sock)
+{
+    (void)sock;
+    return false;
+}
+
+bool Cluster::startWorker(string hostport)
+{
+    (void)hostport;
+    return startMaster(0);
+}
+
+void Cluster::workerLoop() {}
+void Cluster::stop() {}
+void Cluster::sendCommand(string cmd) { (void)cmd; }
+void Cluster::queueHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode)
+{
+    (void)hash; (void)val; (void)staticeval; (void)bound; (void)depth; (void)movecode;
+}
+void Cluster::sendResult(int depth, int score, uint32_t *pv) { (void)depth; (void)score; (void)pv; }
+bool Cluster::getBestResult(int mindepth, int minscore, clusterresult *result)
+{
+    (void)mindepth; (void)minscore; (void)result;
+    return false;
+}
+
+#endif
+
+Cluster cl;
@@ -270,21 +270,6 @@ void traceEvalOut()
 
 }
 
-#if 0  // this could be useful if endgames are preregistered
-void register_endgame(string gamesignature, int(*endgame)(chessposition*))
-{
-    int pcs[16];
-    getPcsFromStr(gamesignature.c_str(), pcs);
-    for (int col = WHITE; col <= BLACK; col++)
-    {
-        U64 mathash = calc_key_from_pcs(pcs, col);
-        Materialhashentry* e;
-        mh.probeHash(mathash, &e);
-    }
-}
-#endif
-
-
 // some common endgames that need help of special evaluation
 static int KBNvK(chessposition *p)
 {
@@ -303,11 +288,117 @@ static int KBNvK(chessposition *p)
 }
 
 
-// get psqt for eval tracing and tuning
+materialentry materialtable[MATERIALTABLESIZE];
+
+static void getScaling(materialentry *mhentry, int counts[7][2])
+{
+    // Calculate scaling for endgames with special material
+    const int *pawns = counts[PAWN];
+    const int *knights = counts[KNIGHT];
+    const int *bishops = counts[BISHOP];
+    const int *rooks = counts[ROOK];
+    const int *queens = counts[QUEEN];
+    const int nonpawnvalue[2] = {
+        knights[WHITE] * materialvalue[KNIGHT]
+        + bishops[WHITE] * materialvalue[BISHOP]
+        + rooks[WHITE] * materialvalue[ROOK]
+        + queens[WHITE] * materialvalue[QUEEN],
+        knights[BLACK] * materialvalue[KNIGHT]
+        + bishops[BLACK] * materialvalue[BISHOP]
+        + rooks[BLACK] * materialvalue[ROOK]
+        + queens[BLACK] * materialvalue[QUEEN]
+    };
+
+    int stronger = (nonpawnvalue[WHITE] > nonpawnvalue[BLACK] || (nonpawnvalue[WHITE] == nonpawnvalue[BLACK] && pawns[WHITE] >= pawns[BLACK])) ? WHITE : BLACK;
+    int weaker = 1 - stronger;
+
+    // Default scaling
+    mhentry->endgame = nullptr;
+    mhentry->scale[WHITE] = mhentry->scale[BLACK] = SCALE_NORMAL;
+    mhentry->ocbCandidate = false;
+    mhentry->onlyPawns = (nonpawnvalue[0] + nonpawnvalue[1] == 0);
+    mhentry->numOfPawns = (uint8_t)(pawns[0] + pawns[1]);
+
+    // special endgames
+    if (knights[stronger] && bishops[stronger] && !pawns[stronger] && !rooks[stronger] && !queens[stronger]
+        && !pawns[weaker] && !nonpawnvalue[weaker])
+    {
+        mhentry->endgame = KBNvK;
+        return;
+    }
+
+    // Check for insufficient material using simnple heuristic from chessprogramming site
+    for (int me = WHITE; me <= BLACK; me++)
+    {
+        int you = me ^ S2MMASK;
+
+        if (pawns[me] == 0 && nonpawnvalue[me] - nonpawnvalue[you] <= materialvalue[BISHOP])
+            mhentry->scale[me] = nonpawnvalue[me] < materialvalue[ROOK] ? SCALE_DRAW : SCALE_HARDTOWIN;
+
+        if (pawns[me] == 1 && nonpawnvalue[me] - nonpawnvalue[you] <= materialvalue[BISHOP])
+            mhentry->scale[me] = SCALE_ONEPAWN;
+    }
+
+    // Opposite colored bishops depend on the squares and are tested in the evaluation
+    mhentry->ocbCandidate = (bishops[WHITE] == 1 && bishops[BLACK] == 1
+        && nonpawnvalue[WHITE] <= materialvalue[BISHOP]
+        && nonpawnvalue[BLACK] <= materialvalue[BISHOP]);
+}
+
+
+void initMaterialtable()
+{
+    int counts[7][2];
+    for (int i = 0; i < MATERIALTABLESIZE; i++)
+    {
+        int index = i;
+        for (int me = BLACK; me >= WHITE; me--)
+        {
+            int ci = index % MTRLCOLORSIZE;
+            index /= MTRLCOLORSIZE;
+            counts[QUEEN][me] = ci % (MTRLMAXQUEENS + 1);
+            ci /= (MTRLMAXQUEENS + 1);
+            for (int pt = ROOK; pt >= KNIGHT; pt--)
+            {
+                counts[pt][me] = ci % (MTRLMAXPIECES + 1);
+                ci /= (MTRLMAXPIECES + 1);
+            }
+            counts[PAWN][me] = ci;
+        }
+        getScaling(&materialtable[i], counts);
+    }
+}
+
+
+int chessposition::getMaterialIndex()
+{
+    int index = 0;
+    for (int me = WHITE; me <= BLACK; me++)
+    {
+        int ci = POPCOUNT(piece00[WPAWN | me]);
+        for (int pt = KNIGHT; pt <= ROOK; pt++)
+        {
+            int n = POPCOUNT(piece00[(pt << 1) | me]);
+            if (n > MTRLMAXPIECES)
+                return -1;
+            ci = ci * (MTRLMAXPIECES + 1) + n;
+        }
+        int n = POPCOUNT(piece00[WQUEEN | me]);
+        if (n > MTRLMAXQUEENS)
+            return -1;
+        index = index * MTRLCOLORSIZE + ci * (MTRLMAXQUEENS + 1) + n;
+    }
+    return index;
+}
+
+
+// get psqt for eval tracing and tuning; only the trace stores the material in te
+template <EvalType Et>
 int chessposition::getpsqval(bool showDetails)
 {
+    const bool bTrace = (Et == TRACE);
     if (showDetails) printf("psq:\n====");
-    te.material[0] = te.material[1] = 0;
+    int material[2] = { 0, 0 };
     for (int j = 0; j < 64; j++)
     {
         // Use the index from whites position for better display
@@ -320,7 +411,7 @@ int chessposition::getpsqval(bool showDetails)
             int s2m = pc & S2MMASK;
             int mv = EVAL(eps.eMaterialvalue[p], S2MSIGN(s2m));
             int pv = EVAL(eps.ePsqt[p][PSQTINDEX(i, s2m)], S2MSIGN(s2m));
-            te.material[s2m] += mv + pv;
+            material[s2m] += mv + pv;
             if (showDetails) printf("%4d ", TAPEREDANDSCALEDEVAL(pv, ph, SCALE_NORMAL));
         }
         else
@@ -329,7 +420,12 @@ int chessposition::getpsqval(bool showDetails)
         }
     }
     if (showDetails) printf("\n\n");
-    return te.material[0] + te.material[1];
+    if (bTrace)
+    {
+        te.material[0] = material[0];
+        te.material[1] = material[1];
+    }
+    return material[0] + material[1];
 }
 
 template <EvalType Et, int Me>
@@ -738,7 +834,7 @@ int chessposition::getEval()
     if (bTrace) te = { { 0 }, { 0 },{ 0 },{ 0 },{ 0 },{ 0 },{ 0 },{ 0 },{ 0 },{ 0 }, 0, 0, 0, 0, 0 };
 #ifdef EVALTUNE
     resetTuner();
-    getpsqval();
+    getpsqval<TRACE>();
 #endif
     ph = phase();
 
@@ -746,6 +842,7 @@ int chessposition::getEval()
 #ifdef NNUE
     if (NnueReady)
     {
+        PROFILESCOPE(PROF_EVALNNUE);
         if (NnueReady == NnueRotate)
             score = NnueGetEval<NnueRotate>() + eps.eTempo;
         else
@@ -754,13 +851,28 @@ int chessposition::getEval()
     }
 #endif
 
+    PROFILESCOPE(PROF_EVALCLASSICAL);
+
     // reset the attackedBy information
     memset(attackedBy, 0, sizeof(attackedBy));
 
     positioneval pe;
-    bool hashexist = mtrlhsh.probeHash(materialhash, &pe.mhentry);
-    if (!hashexist)
-        getScaling(pe.mhentry);
+    materialentry overflowentry;
+    int materialindex = getMaterialIndex();
+    if (materialindex >= 0)
+    {
+        pe.mhentry = &materialtable[materialindex];
+    }
+    else
+    {
+        // unusual material after underpromotion or second queen
+        int counts[7][2];
+        for (int pt = PAWN; pt <= QUEEN; pt++)
+            for (int me = WHITE; me <= BLACK; me++)
+                counts[pt][me] = POPCOUNT(piece00[(pt << 1) | me]);
+        getScaling(&overflowentry, counts);
+        pe.mhentry = &overflowentry;
+    }
 
     if (pe.mhentry->endgame)
     {
@@ -773,7 +885,17 @@ int chessposition::getEval()
         return score;
     }
 
-    hashexist = pwnhsh.probeHash(pawnhash, &pe.phentry);
+    bool hashexist;
+    if (sphsh)
+    {
+        U64 pawns[2] = { piece00[WPAWN], piece00[BPAWN] };
+        pe.phentry = &sharedphentry;
+        hashexist = sphsh->probeHash(pawnhash, pawns, pe.phentry);
+    }
+    else
+    {
+        hashexist = pwnhsh.probeHash(pawnhash, &pe.phentry);
+    }
     if (bTrace || !hashexist)
     {
         if (bTrace) pe.phentry->value = 0;
@@ -781,6 +903,8 @@ int chessposition::getEval()
         getPawnAndKingEval<Et, 1>(pe.phentry);
         U64 pawns = piece00[WPAWN] | piece00[BPAWN];
         pe.phentry->bothFlanks = ((pawns & FLANKLEFT) && (pawns & FLANKRIGHT));
+        if (sphsh && !hashexist)
+            sphsh->addHash(pawnhash, pe.phentry);
     }
 
     int pawnEval = pe.phentry->value;
@@ -796,6 +920,12 @@ int chessposition::getEval()
     int sideToScale = GETEGVAL(totalEval) > SCOREDRAW ? WHITE : BLACK;
 
     sc = pe.mhentry->scale[sideToScale];
+    if (pe.mhentry->ocbCandidate)
+    {
+        U64 bishopsbb = (piece00[WBISHOP] | piece00[BBISHOP]);
+        if ((bishopsbb & WHITEBB) && (bishopsbb & BLACKBB))
+            sc = SCALE_OCB;
+    }
     if (!bTrace && sc == SCALE_DRAW)
         return SCOREDRAW;
 
@@ -812,7 +942,7 @@ int chessposition::getEval()
 
     if (bTrace)
     {
-        getpsqval(en.evaldetails);
+        getpsqval<TRACE>(en.evaldetails);
         te.sc = sc;
         te.ph = ph;
         te.total = totalEval;
@@ -824,7 +954,7 @@ int chessposition::getEval()
 }
 
 
-int chessposition::getComplexity(int val, pawnhashentry *phentry, Materialhashentry *mhentry)
+int chessposition::getComplexity(int val, pawnhashentry *phentry, materialentry *mhentry)
 {
         int evaleg = GETEGVAL(val);
         int sign = (evaleg > 0) - (evaleg < 0);
@@ -837,65 +967,9 @@ int chessposition::getComplexity(int val, pawnhashentry *phentry, Materialhashen
 }
 
 
-void chessposition::getScaling(Materialhashentry* mhentry)
-{
-    // Calculate scaling for endgames with special material
-    const int pawns[2] = { POPCOUNT(piece00[WPAWN]), POPCOUNT(piece00[BPAWN]) };
-    const int knights[2] = { POPCOUNT(piece00[WKNIGHT]), POPCOUNT(piece00[BKNIGHT]) };
-    const int bishops[2] = { POPCOUNT(piece00[WBISHOP]), POPCOUNT(piece00[BBISHOP]) };
-    const int rooks[2] = { POPCOUNT(piece00[WROOK]), POPCOUNT(piece00[BROOK]) };
-    const int queens[2] = { POPCOUNT(piece00[WQUEEN]), POPCOUNT(piece00[BQUEEN]) };
-    const int nonpawnvalue[2] = {
-        knights[WHITE] * materialvalue[KNIGHT]
-        + bishops[WHITE] * materialvalue[BISHOP]
-        + rooks[WHITE] * materialvalue[ROOK]
-        + queens[WHITE] * materialvalue[QUEEN],
-        knights[BLACK] * materialvalue[KNIGHT]
-        + bishops[BLACK] * materialvalue[BISHOP]
-        + rooks[BLACK] * materialvalue[ROOK]
-        + queens[BLACK] * materialvalue[QUEEN]
-    };
-
-    int stronger = (nonpawnvalue[WHITE] > nonpawnvalue[BLACK] || (nonpawnvalue[WHITE] == nonpawnvalue[BLACK] && pawns[WHITE] >= pawns[BLACK])) ? WHITE : BLACK;
-    int weaker = 1 - stronger;
-
-    // special endgames
-    if (piece00[WKNIGHT | stronger] && piece00[WBISHOP | stronger]
-        && (occupied00[stronger] ^ piece00[WKNIGHT | stronger] ^ piece00[WBISHOP | stronger]) == piece00[WKING | stronger]
-        && piece00[WKING | weaker] == occupied00[weaker])
-    {
-        mhentry->endgame = KBNvK;
-        return;
-    }
-
-
-    // Default scaling
-    mhentry->scale[WHITE] = mhentry->scale[BLACK] = SCALE_NORMAL;
-
-    // Check for insufficient material using simnple heuristic from chessprogramming site
-    for (int me = WHITE; me <= BLACK; me++)
-    {
-        int you = me ^ S2MMASK;
-
-        if (pawns[me] == 0 && nonpawnvalue[me] - nonpawnvalue[you] <= materialvalue[BISHOP])
-            mhentry->scale[me] = nonpawnvalue[me] < materialvalue[ROOK] ? SCALE_DRAW : SCALE_HARDTOWIN;
-
-        if (pawns[me] == 1 && nonpawnvalue[me] - nonpawnvalue[you] <= materialvalue[BISHOP])
-            mhentry->scale[me] = SCALE_ONEPAWN;
-    }
-
-    U64 bishopsbb = (piece00[WBISHOP] | piece00[BBISHOP]);
-    if (bishops[WHITE] == 1 && bishops[BLACK] == 1
-        && (bishopsbb & WHITEBB) && (bishopsbb & BLACKBB)
-        && nonpawnvalue[WHITE] <= materialvalue[BISHOP]
-        && nonpawnvalue[BLACK] <= materialvalue[BISHOP])
-        mhentry->scale[WHITE] = mhentry->scale[BLACK] = SCALE_OCB;
-    
-    mhentry->onlyPawns = (nonpawnvalue[0] + nonpawnvalue[1] == 0);
-    mhentry->numOfPawns = pawns[0] + pawns[1];
-}
-
 // Explicit template instantiation
 // This avoids putting these definitions in header file
 template int chessposition::getEval<NOTRACE>();
 template int chessposition::getEval<TRACE>();
+template int chessposition::getpsqval<NOTRACE>(bool showDetails);
+template int chessposition::getpsqval<TRACE>(bool showDetails);
@@ -88,69 +88,263 @@ void generateEpd(string egn)
 }
 
 
-long long engine::perft(int depth, bool dotests)
+//
+// Perft
+// The root moves (and for deeper perfts the replies to them) are distributed over the threads with an
+// atomic index. All threads share a lockless hash of subtree counts; entries are stored as (key ^ data, data)
+// so a torn write is detected by the xor check and simply treated as a miss.
+//
+struct perfthashentry
 {
-    long long retval = 0;
-    chessposition *rootpos = &en.sthread[0].pos;
+    atomic<U64> check;
+    atomic<U64> data;   // nodes << 8 | depth
+};
+
+static perfthashentry *perfthash = nullptr;
+static U64 perfthashmask = 0;
+
+static U64 perftHashKey(U64 hash, int depth)
+{
+    return hash ^ (depth * 0x9e3779b97f4a7c15ULL);
+}
+
+static bool probePerftHash(U64 hash, int depth, U64 *nodes)
+{
+    U64 key = perftHashKey(hash, depth);
+    perfthashentry *e = &perfthash[key & perfthashmask];
+    U64 data = e->data.load(memory_order_relaxed);
+    U64 check = e->check.load(memory_order_relaxed);
+    if ((check ^ data) != key || (int)(data & 0xff) != depth)
+        return false;
+    *nodes = data >> 8;
+    return true;
+}
+
+static void storePerftHash(U64 hash, int depth, U64 nodes)
+{
+    U64 key = perftHashKey(hash, depth);
+    perfthashentry *e = &perfthash[key & perfthashmask];
+    U64 data = (nodes << 8) | depth;
+    e->data.store(data, memory_order_relaxed);
+    e->check.store(key ^ data, memory_order_relaxed);
+}
+
+
+// Check hashes, incremental psq value and eval symmetry of a position
+static void perftTests(chessposition *pos)
+{
+    if (pos->hash != zb.getHash(pos))
+    {
+        printf("Alarm! Wrong Hash! %llu\n", zb.getHash(pos));
+        pos->print();
+    }
+    if (pos->pawnhash && pos->pawnhash != zb.getPawnHash(pos))
+    {
+        printf("Alarm! Wrong Pawn Hash! %llu\n", zb.getPawnHash(pos));
+        pos->print();
+    }
+    if (pos->materialhash != zb.getMaterialHash(pos))
+    {
+        printf("Alarm! Wrong Material Hash! %llu\n", zb.getMaterialHash(pos));
+        pos->print();
+    }
+    int val1 = pos->getEval<NOTRACE>();
+    int psq1 = pos->getpsqval<NOTRACE>();
+    if (pos->psqval != psq1)
+    {
+        printf("PSQ-Test  :error  incremental:%d  recalculated:%d\n", pos->psqval, psq1);
+        pos->print();
+    }
+    pos->mirror();
+    int val2 = pos->getEval<NOTRACE>();
+    pos->mirror();
+    int val3 = pos->getEval<NOTRACE>();
+    if (!(val1 == val3 && val1 == val2))
+    {
+        printf("Mirrortest  :error  (%d / %d / %d)\n", val1, val2, val3);
+        pos->print();
+        pos->mirror();
+        pos->print();
+        pos->mirror();
+        pos->print();
+    }
+}
+
+
+static U64 perftPosition(chessposition *pos, int depth, bool dotests)
+{
+    U64 retval = 0;
+
+    if (dotests)
+        perftTests(pos);
+
+    if (depth == 0)
+        return 1;
+
+    // the tests should see every node so the hash is only used without them
+    bool usehash = (perfthash && depth > 1 && !dotests);
+    if (usehash && probePerftHash(pos->hash, depth, &retval))
+        return retval;
+
+    chessmovelist movelist;
+    movelist.length = CreateLegalMovelist(pos, &movelist.move[0]);
+
+    // bulk counting; the moves of the legal generator don't need to be played at the last ply
+    if (depth == 1 && !dotests)
+        return movelist.length;
+
+    pos->prepareStack();
 
     if (dotests)
     {
-        if (rootpos->hash != zb.getHash(rootpos))
-        {
-            printf("Alarm! Wrong Hash! %llu\n", zb.getHash(rootpos));
-            rootpos->print();
-        }
-        if (rootpos->pawnhash && rootpos->pawnhash != zb.getPawnHash(rootpos))
+        // compare the legal generator with the pseudo-legal generators and the legality test of playMove
+        chessmovelist pseudolegal;
+        if (pos->isCheckbb)
+            pseudolegal.length = CreateEvasionMovelist(pos, &pseudolegal.move[0]);
+        else
+            pseudolegal.length = CreateMovelist<ALL>(pos, &pseudolegal.move[0]);
+        int legalmoves = 0;
+        for (int i = 0; i < pseudolegal.length; i++)
         {
-            printf("Alarm! Wrong Pawn Hash! %llu\n", zb.getPawnHash(rootpos));
-            rootpos->print();
+            if (pos->playMove(&pseudolegal.move[i]))
+            {
+                legalmoves++;
+                pos->unplayMove(&pseudolegal.move[i]);
+            }
         }
-        if (rootpos->materialhash != zb.getMaterialHash(rootpos))
+        if (legalmoves != movelist.length)
         {
-            printf("Alarm! Wrong Material Hash! %llu\n", zb.getMaterialHash(rootpos));
-            rootpos->print();
+            printf("Alarm! Legal move generator found %d moves instead of %d\n", movelist.length, legalmoves);
+            pos->print();
         }
-        int val1 = rootpos->getEval<NOTRACE>();
-        int psq1 = rootpos->getpsqval();
-        if (rootpos->psqval != psq1)
+    }
+
+    for (int i = 0; i < movelist.length; i++)
+    {
+        pos->playMove(&movelist.move[i]);
+        retval += perftPosition(pos, depth - 1, dotests);
+        pos->unplayMove(&movelist.move[i]);
+    }
+
+    if (usehash)
+        storePerftHash(pos->hash, depth, retval);
+
+    return retval;
+}
+
+
+struct perftjob
+{
+    int rootindex;
+    chessmove reply;    // code 0 if the job is the whole subtree of the root move
+};
+
+
+static void perftWorker(chessposition *pos, chessmovelist *rootmoves, vector<perftjob> *jobs, atomic<int> *nextjob,
+    atomic<U64> *rootnodes, int depth, bool dotests)
+{
+    int j;
+    while ((j = nextjob->fetch_add(1)) < (int)jobs->size())
+    {
+        perftjob *job = &(*jobs)[j];
+        chessmove *m = &rootmoves->move[job->rootindex];
+        U64 nodes;
+        pos->prepareStack();
+        pos->playMove(m);
+        if (job->reply.code)
         {
-            printf("PSQ-Test  :error  incremental:%d  recalculated:%d\n", rootpos->psqval, psq1);
-            rootpos->print();
+            pos->prepareStack();
+            pos->playMove(&job->reply);
+            nodes = perftPosition(pos, depth - 2, dotests);
+            pos->unplayMove(&job->reply);
         }
-        rootpos->mirror();
-        int val2 = rootpos->getEval<NOTRACE>();
-        rootpos->mirror();
-        int val3 = rootpos->getEval<NOTRACE>();
-        if (!(val1 == val3 && val1 == val2))
+        else
         {
-            printf("Mirrortest  :error  (%d / %d / %d)\n", val1, val2, val3);
-            rootpos->print();
-            rootpos->mirror();
-            rootpos->print();
-            rootpos->mirror();
-            rootpos->print();
+            nodes = perftPosition(pos, depth - 1, dotests);
         }
+        pos->unplayMove(m);
+        rootnodes[job->rootindex] += nodes;
     }
+}
 
-    if (depth == 0)
-        return 1;
 
-    chessmovelist movelist;
-    if (rootpos->isCheckbb)
-        movelist.length = CreateEvasionMovelist(rootpos, &movelist.move[0]);
-    else
-        movelist.length = CreateMovelist<ALL>(rootpos, &movelist.move[0]);
+long long engine::perft(int depth, bool dotests, bool divide)
+{
+    chessposition *rootpos = &sthread[0].pos;
+
+    if (dotests)
+        perftTests(rootpos);
 
+    if (depth == 0 || (depth == 1 && !divide))
+        return perftPosition(rootpos, depth, dotests);
+
+    chessmovelist rootmoves;
+    rootmoves.length = CreateLegalMovelist(rootpos, &rootmoves.move[0]);
+
+    // one job per root move or, for deeper perfts, one per reply to get a better balance
+    vector<perftjob> jobs;
     rootpos->prepareStack();
+    for (int i = 0; i < rootmoves.length; i++)
+    {
+        chessmovelist replies;
+        replies.length = 0;
+        if (depth > 3)
+        {
+            rootpos->playMove(&rootmoves.move[i]);
+            replies.length = CreateLegalMovelist(rootpos, &replies.move[0]);
+            rootpos->unplayMove(&rootmoves.move[i]);
+        }
+        if (!replies.length)
+            jobs.push_back({ i, chessmove() });
+        for (int j = 0; j < replies.length; j++)
+            jobs.push_back({ i, replies.move[j] });
+    }
 
-    for (int i = 0; i < movelist.length; i++)
+    if (!dotests && depth > 2)
     {
-        if (rootpos->playMove(&movelist.move[i]))
+        unsigned long msb = 0;
+        U64 entries = ((U64)Hash << 20) / sizeof(perfthashentry);
+        GETMSB(msb, entries);
+        entries = (1ULL << msb);
+        perfthash = (perfthashentry*)allocalign64(entries * sizeof(perfthashentry));
+        if (perfthash)
         {
-            retval += perft(depth - 1, dotests);
-            rootpos->unplayMove(&movelist.move[i]);
+            memset((void*)perfthash, 0, entries * sizeof(perfthashentry));
+            perfthashmask = entries - 1;
         }
     }
+
+    atomic<U64> rootnodes[MAXMOVELISTLENGTH];
+    for (int i = 0; i < rootmoves.length; i++)
+        rootnodes[i] = 0;
+    atomic<int> nextjob(0);
+    vector<thread> workers;
+    for (int i = 1; i < Threads; i++)
+    {
+        chessposition *pos = &sthread[i].pos;
+        pos->copyRootState(rootpos);
+        pos->threadindex = i;
+        workers.push_back(thread(perftWorker, pos, &rootmoves, &jobs, &nextjob, rootnodes, depth, dotests));
+    }
+    perftWorker(rootpos, &rootmoves, &jobs, &nextjob, rootnodes, depth, dotests);
+    for (auto& w : workers)
+        w.join();
+
+    if (perfthash)
+    {
+        freealigned64(perfthash);
+        perfthash = nullptr;
+    }
+
+    long long retval = 0;
+    for (int i = 0; i < rootmoves.length; i++)
+    {
+        if (divide)
+            cout << rootmoves.move[i].toString() << ": " << rootnodes[i] << "\n";
+        retval += rootnodes[i];
+    }
+    if (divide)
+        cout << "\nMoves: " << rootmoves.length << "\n";
     return retval;
 }
 
@@ -225,7 +419,7 @@ static void perftest(bool dotests, int maxdepth)
     printf("\n\nPerft results for %s (Build %s)\n", en.name().c_str(), BUILD);
     printf("System: %s\n", cinfo.SystemName().c_str());
     printf("CPU-Features of system: %s\nCPU-Features of binary: %s\n", cinfo.PrintCpuFeatures(cinfo.machineSupports).c_str(), cinfo.PrintCpuFeatures(cinfo.binarySupports).c_str());
-    printf("Depth = %d    %8s  Hash-/Mirror-Tests %s\n", maxdepth, en.chess960 ? "Chess960" : "", dotests ? "enabled" : "disabled");
+    printf("Depth = %d    %8s  Hash-/Mirror-Tests %s    Threads = %d\n", maxdepth, en.chess960 ? "Chess960" : "", dotests ? "enabled" : "disabled", en.Threads);
     printf("========================================================================\n");
 
     float df;
@@ -294,124 +488,201 @@ static void benchTableHeader(FILE* out)
         fprintf(out, "=============================================================================================================\n");
 }
 
-static void benchTableItem(FILE* out, int i, benchmarkstruct *bm)
+static string benchPerfValue(perfcountervalues *pc, int counter, double divisor, const char *format)
+{
+    char s[32];
+    if (!pc->valid[counter] || divisor <= 0.0)
+        return "n/a";
+    snprintf(s, sizeof(s), format, pc->value[counter] / divisor);
+    return s;
+}
+
+static void benchTablePerf(FILE *out, perfcountervalues *pc, PerfCounterMode mode, long long nodes)
+{
+    double n = (double)nodes;
+    if (mode == PERFHARDWARE)
+        fprintf(out, "           IPC %s  cycles/node %s  L1D-misses/node %s  LLC-misses/node %s  dTLB-misses/node %s  branch-misses/node %s\n",
+            benchPerfValue(pc, PERF_INSTRUCTIONS, (double)pc->value[PERF_CYCLES], "%.2f").c_str(),
+            benchPerfValue(pc, PERF_CYCLES, n, "%.0f").c_str(),
+            benchPerfValue(pc, PERF_L1DMISSES, n, "%.2f").c_str(),
+            benchPerfValue(pc, PERF_LLCMISSES, n, "%.3f").c_str(),
+            benchPerfValue(pc, PERF_DTLBMISSES, n, "%.3f").c_str(),
+            benchPerfValue(pc, PERF_BRANCHMISSES, n, "%.2f").c_str());
+    else if (mode == PERFSOFTWARE)
+        fprintf(out, "           task-clock %s sec.  task-clock/node %s ns  page-faults %s  context-switches %s  cpu-migrations %s\n",
+            benchPerfValue(pc, PERF_TASKCLOCK, 1e9, "%.3f").c_str(),
+            benchPerfValue(pc, PERF_TASKCLOCK, n, "%.1f").c_str(),
+            benchPerfValue(pc, PERF_PAGEFAULTS, 1.0, "%.0f").c_str(),
+            benchPerfValue(pc, PERF_CONTEXTSWITCHES, 1.0, "%.0f").c_str(),
+            benchPerfValue(pc, PERF_MIGRATIONS, 1.0, "%.0f").c_str());
+}
+
+static void benchTableItem(FILE* out, int i, benchmarkstruct *bm, perfcountervalues *pc = nullptr, PerfCounterMode mode = PERFNONE)
 {
     fprintf(out, "Bench # %3d (%14s / %2d): %s  %5s %6d cp %3d ply %10f sec. %10lld nodes %10lld nps\n", i, bm->name.c_str(), bm->depth, solvedstr[bm->solved].c_str(), bm->move.c_str(), bm->score, bm->depthAtExit, (float)bm->time / (float)en.frequency, bm->nodes, bm->nodes * en.frequency / bm->time);
+    if (pc)
+        benchTablePerf(out, pc, mode, bm->nodes);
 }
 
-static void benchTableFooder(FILE *out, long long totaltime, long long totalnodes, int totalsolved[2])
+static void benchTableFooder(FILE *out, long long totaltime, long long totalnodes, int totalsolved[2], perfcountervalues *pc = nullptr, PerfCounterMode mode = PERFNONE)
 {
     int totaltests = totalsolved[0] + totalsolved[1];
     double fSolved = totaltests ? 100.0 * totalsolved[1] / (double)totaltests : 0.0;
     fprintf(out, "=============================================================================================================\n");
     fprintf(out, "Overall:                  %4d/%3d = %4.1f%%                    %10f sec. %10lld nodes %*lld nps\n",
         totalsolved[1], totaltests, fSolved, ((float)totaltime / (float)en.frequency), totalnodes, 10, totalnodes * en.frequency / totaltime);
+    if (pc)
+        benchTablePerf(out, pc, mode, totalnodes);
 }
 
-static void doBenchmark(int constdepth, string epdfilename, int consttime, int startnum, bool openbench)
+static const benchmarkstruct benchmarkpositions[] =
 {
-    benchmarkstruct benchmark[] =
+    {   
+        "Startposition",
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        14,
+        0,
+        0, 0, 0, 0, "", 0
+    },
     {
-        {   
-            "Startposition",
-            "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-            14,
-            0,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "Lasker Test",
-            "8/k7/3p4/p2P1p2/P2P1P2/8/8/K7 w - - 0 1",
-            28,
-            0,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "IQ4 63",
-            "2R5/r3b1k1/p2p4/P1pPp2p/6q1/2P2N1r/4Q1P1/5RK1 w - - 0 1 ",
-            14,
-            300,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "Wacnew 167",
-            "7Q/ppp2q2/3p2k1/P2Ppr1N/1PP5/7R/5rP1/6K1 b - - 0 1",
-            14,
-            1000,
-            0, 0, 0, 0, "", 0
-        },
-        { 
-            "Wacnew 212",
-            "rn1qr2Q/pbppk1p1/1p2pb2/4N3/3P4/2N5/PPP3PP/R4RK1 w - - 0 1",
-            14,
-            500,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "Carlos 6",
-            "rn1q1r2/1bp1bpk1/p3p2p/1p2N1pn/3P4/1BN1P1B1/PPQ2PPP/2R2RK1 w - - 0 1",
-            13,
-            300,
-            0, 0, 0, 0, "", 0
-        },
-         
-        {
-            "Arasan19 83",
-            "6k1/p4qp1/1p3r1p/2pPp1p1/1PP1PnP1/2P1KR1P/1B6/7Q b - - 0 1 ",
-            14,
-            200,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "Arasan19 192",
-            "r2qk2r/1b1nbp1p/p1n1p1p1/1pp1P3/6Q1/2NPB1PN/PPP3BP/R4RK1 w kq - 0 1",
-            13,
-            150,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "BT2630 12",
-            "8/pp3k2/2p1qp2/2P5/5P2/1R2p1rp/PP2R3/4K2Q b - - 0 1",
-            15,
-            300,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "IQ4 116",
-            "4r1k1/1p2qrpb/p1p4p/2Pp1p2/1Q1Rn3/PNN1P1P1/1P3PP1/3R2K1 b - - 0 1",
-            14,
-            300,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "Arasan12 114",
-            "br4k1/1qrnbppp/pp1ppn2/8/NPPBP3/PN3P2/5QPP/2RR1B1K w - - 0 1",
-            15,
-            150,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "Arasan12 140",
-            "r1b1rk2/p1pq2p1/1p1b1p1p/n2P4/2P1NP2/P2B1R2/1BQ3PP/R6K w - - 0 1",
-            15,
-            300,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "Arasan12 137",
-            "r4k2/1b3ppp/p2n1P2/q1p3PQ/Np1rp3/1P1B4/P1P4P/2K1R2R w - - 0 1",
-            14,
-            200,
-            0, 0, 0, 0, "", 0
-        },
-        {
-            "", "", 0, 0,
-            0, 0, 0, 0, "", 0
-        }
-    };
+        "Lasker Test",
+        "8/k7/3p4/p2P1p2/P2P1P2/8/8/K7 w - - 0 1",
+        28,
+        0,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "IQ4 63",
+        "2R5/r3b1k1/p2p4/P1pPp2p/6q1/2P2N1r/4Q1P1/5RK1 w - - 0 1 ",
+        14,
+        300,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "Wacnew 167",
+        "7Q/ppp2q2/3p2k1/P2Ppr1N/1PP5/7R/5rP1/6K1 b - - 0 1",
+        14,
+        1000,
+        0, 0, 0, 0, "", 0
+    },
+    { 
+        "Wacnew 212",
+        "rn1qr2Q/pbppk1p1/1p2pb2/4N3/3P4/2N5/PPP3PP/R4RK1 w - - 0 1",
+        14,
+        500,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "Carlos 6",
+        "rn1q1r2/1bp1bpk1/p3p2p/1p2N1pn/3P4/1BN1P1B1/PPQ2PPP/2R2RK1 w - - 0 1",
+        13,
+        300,
+        0, 0, 0, 0, "", 0
+    },
+     
+    {
+        "Arasan19 83",
+        "6k1/p4qp1/1p3r1p/2pPp1p1/1PP1PnP1/2P1KR1P/1B6/7Q b - - 0 1 ",
+        14,
+        200,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "Arasan19 192",
+        "r2qk2r/1b1nbp1p/p1n1p1p1/1pp1P3/6Q1/2NPB1PN/PPP3BP/R4RK1 w kq - 0 1",
+        13,
+        150,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "BT2630 12",
+        "8/pp3k2/2p1qp2/2P5/5P2/1R2p1rp/PP2R3/4K2Q b - - 0 1",
+        15,
+        300,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "IQ4 116",
+        "4r1k1/1p2qrpb/p1p4p/2Pp1p2/1Q1Rn3/PNN1P1P1/1P3PP1/3R2K1 b - - 0 1",
+        14,
+        300,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "Arasan12 114",
+        "br4k1/1qrnbppp/pp1ppn2/8/NPPBP3/PN3P2/5QPP/2RR1B1K w - - 0 1",
+        15,
+        150,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "Arasan12 140",
+        "r1b1rk2/p1pq2p1/1p1b1p1p/n2P4/2P1NP2/P2B1R2/1BQ3PP/R6K w - - 0 1",
+        15,
+        300,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "Arasan12 137",
+        "r4k2/1b3ppp/p2n1P2/q1p3PQ/Np1rp3/1P1B4/P1P4P/2K1R2R w - - 0 1",
+        14,
+        200,
+        0, 0, 0, 0, "", 0
+    },
+    {
+        "", "", 0, 0,
+        0, 0, 0, 0, "", 0
+    }
+};
+
+
+static void benchRunPosition(benchmarkstruct *bm, int constdepth, int consttime, perfcounters *pc = nullptr, perfcountervalues *pv = nullptr)
+{
+    en.communicate("ucinewgame");
+    en.communicate("position fen " + bm->fen);
+    long long starttime = getTime();
+    int dp = (constdepth ? constdepth : bm->depth);
+    int tm = consttime;
+    if (bm->terminationscore)
+        en.terminationscore = bm->terminationscore;
+    else
+        en.terminationscore = SHRT_MAX;
+    if (pc)
+        pc->start();
+    if (tm)
+        en.communicate("go movetime " + to_string(tm * 1000));
+    else if (dp)
+        en.communicate("go depth " + to_string(dp));
+    else
+        en.communicate("go infinite");
+    if (pc)
+        pc->stop(pv);
+
+    bm->time = getTime() - starttime;
+    bm->nodes = en.getTotalNodes();
+    bm->score = en.rootposition.lastbestmovescore;
+    bm->depthAtExit = en.benchdepth;
+    bm->move = en.benchmove;
+}
 
-    long long starttime, endtime;
+
+// 1 if the move is one of the best moves or none of the moves to avoid, 2 if the epd has neither
+static int benchSolved(string move, string bestmoves, string avoidmoves)
+{
+    if (bestmoves != "")
+        return (bestmoves.find(move) != string::npos) ? 1 : 0;
+    if (avoidmoves != "")
+        return (avoidmoves.find(move) != string::npos) ? 0 : 1;
+    return 2;
+}
+
+
+static void doBenchmark(int constdepth, string epdfilename, int consttime, int startnum, bool openbench, bool perfcount, list<benchmarkstruct> *results = nullptr)
+{
     list<benchmarkstruct> bmlist;
+    list<perfcountervalues> perflist;
+    perfcountervalues pv, totalpv;
+    perfcounters pc;
 
     ifstream epdfile;
     bool bGetFromEpd = false;
@@ -426,8 +697,22 @@ static void doBenchmark(int constdepth, string epdfilename, int consttime, int s
     int i = 0;
     int totalSolved[2] = { 0 };
     benchmarkstruct epdbm;
+    benchmarkstruct stdbm;
     FILE *tableout = openbench ? stdout : stderr;
 
+#ifdef PROFILING
+    profileReset();
+#endif
+
+    if (perfcount)
+    {
+        if (pc.init() == PERFNONE)
+            fprintf(tableout, "Performance counters are not available on this system.\n");
+        else if (pc.mode == PERFSOFTWARE)
+            fprintf(tableout, "Hardware performance counters are not available; using software counters.\n");
+    }
+    memset(&totalpv, 0, sizeof(totalpv));
+
     while (true)
     {
         string avoidmoves = "";
@@ -436,99 +721,1249 @@ static void doBenchmark(int constdepth, string epdfilename, int consttime, int s
         if (!bGetFromEpd)
         {
             // standard bench with included positions
-            bm = &benchmark[i];
+            stdbm = benchmarkpositions[i];
+            bm = &stdbm;
+        }
+        else
+        {
+            // read positions from epd file
+            bm = &epdbm;
+            string line;
+            getline(epdfile, line);
+            getFenAndBmFromEpd(line, &bm->fen, &bestmoves, &avoidmoves);
+
+            bm->depth = 10;  // default depth for epd bench
+            bm->terminationscore = 0;
+        }
+        if (bm->fen == "") break;
+
+        if (++i < startnum) continue;
+
+        benchRunPosition(bm, constdepth, consttime, pc.mode ? &pc : nullptr, &pv);
+        bm->solved = benchSolved(bm->move, bestmoves, avoidmoves);
+        if (bm->solved < 2)
+            totalSolved[bm->solved]++;
+
+        if (bGetFromEpd)
+            benchTableItem(tableout, i, bm, pc.mode ? &pv : nullptr, pc.mode);
+
+        bmlist.push_back(*bm);
+        if (pc.mode)
+        {
+            perflist.push_back(pv);
+            for (int j = 0; j < PERF_NUM; j++)
+            {
+                totalpv.value[j] += pv.value[j];
+                totalpv.valid[j] = totalpv.valid[j] || pv.valid[j];
+            }
+        }
+    }
+
+    en.terminationscore = SHRT_MAX;
+    i = 0;
+    long long totaltime = 0;
+    long long totalnodes = 0;
+    benchTableHeader(tableout);
+
+    list<perfcountervalues>::iterator perf = perflist.begin();
+    for (list<benchmarkstruct>::iterator bm = bmlist.begin(); bm != bmlist.end(); bm++)
+    {
+        totaltime += bm->time;
+        totalnodes += bm->nodes;
+        benchTableItem(tableout, ++i, &*bm, pc.mode ? &*perf++ : nullptr, pc.mode);
+    }
+    if (totaltime)
+    {
+        benchTableFooder(tableout, totaltime, totalnodes, totalSolved, pc.mode ? &totalpv : nullptr, pc.mode);
+        if (openbench)
+            printf("Time  : %lld\nNodes : %lld\nNPS   : %lld\n", totaltime * 1000 / en.frequency, totalnodes, totalnodes * en.frequency / totaltime);
+    }
+#ifdef PROFILING
+    profilePrint(tableout);
+#endif
+    if (results)
+        *results = bmlist;
+}
+
+
+//
+// Machine readable bench results and comparison against a baseline for regression checks
+// The file has one position per line so that -benchcompare can read it without a complete json parser.
+//
+
+static string jsonString(string s)
+{
+    string r = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            r += '\\';
+        if ((unsigned char)c >= 0x20)
+            r += c;
+    }
+    return r + "\"";
+}
+
+
+template <typename T> static string jsonArray(vector<T> v, const char *format)
+{
+    string r = "[";
+    char s[32];
+    for (size_t i = 0; i < v.size(); i++)
+    {
+        snprintf(s, sizeof(s), format, v[i]);
+        if (i)
+            r += ", ";
+        r += s;
+    }
+    return r + "]";
+}
+
+
+static void benchWriteJson(string filename, vector<list<benchmarkstruct>> &runs)
+{
+    FILE *out = fopen(filename.c_str(), "w");
+    if (!out)
+    {
+        printf("Cannot open file %s for writing.\n", filename.c_str());
+        return;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"engine\": %s,\n", jsonString(en.name()).c_str());
+    fprintf(out, "  \"build\": %s,\n", jsonString(BUILD).c_str());
+    fprintf(out, "  \"system\": %s,\n", jsonString(cinfo.SystemName()).c_str());
+    fprintf(out, "  \"cpufeaturessystem\": %s,\n", jsonString(cinfo.PrintCpuFeatures(cinfo.machineSupports)).c_str());
+    fprintf(out, "  \"cpufeaturesbinary\": %s,\n", jsonString(cinfo.PrintCpuFeatures(cinfo.binarySupports)).c_str());
+    fprintf(out, "  \"threads\": %d,\n", en.Threads);
+    fprintf(out, "  \"hash\": %d,\n", en.Hash);
+    fprintf(out, "  \"runs\": %d,\n", (int)runs.size());
+    fprintf(out, "  \"positions\": [\n");
+
+    // time and nps are arrays with one value per run; the other values are the ones of the last run
+    vector<list<benchmarkstruct>::iterator> it;
+    for (auto& r : runs)
+        it.push_back(r.begin());
+    vector<double> totaltime(runs.size(), 0.0);
+    vector<long long> totalnodes(runs.size(), 0);
+    bool first = true;
+    while (it.size() && it[0] != runs[0].end())
+    {
+        vector<double> time;
+        vector<long long> nps;
+        benchmarkstruct *bm = nullptr;
+        for (size_t r = 0; r < runs.size(); r++)
+        {
+            bm = &*it[r]++;
+            time.push_back((double)bm->time / en.frequency);
+            nps.push_back(bm->time ? bm->nodes * en.frequency / bm->time : 0);
+            totaltime[r] += time.back();
+            totalnodes[r] += bm->nodes;
+        }
+        string move = bm->move;
+        move.erase(move.find_last_not_of(' ') + 1);
+        fprintf(out, "%s    { \"name\": %s, \"fen\": %s, \"depth\": %d, \"depthreached\": %d, \"nodes\": %lld, \"move\": %s, \"score\": %d, \"solved\": %s, \"time\": %s, \"nps\": %s }",
+            first ? "" : ",\n", jsonString(bm->name).c_str(), jsonString(bm->fen).c_str(), bm->depth, bm->depthAtExit, bm->nodes,
+            jsonString(move).c_str(), bm->score, bm->solved == 2 ? "null" : bm->solved ? "true" : "false",
+            jsonArray(time, "%.6f").c_str(), jsonArray(nps, "%lld").c_str());
+        first = false;
+    }
+
+    vector<long long> totalnps;
+    for (size_t r = 0; r < runs.size(); r++)
+        totalnps.push_back(totaltime[r] > 0.0 ? (long long)(totalnodes[r] / totaltime[r]) : 0);
+    fprintf(out, "\n  ],\n");
+    fprintf(out, "  \"total\": { \"nodes\": %lld, \"time\": %s, \"nps\": %s }\n", totalnodes.size() ? totalnodes.back() : 0,
+        jsonArray(totaltime, "%.6f").c_str(), jsonArray(totalnps, "%lld").c_str());
+    fprintf(out, "}\n");
+    fclose(out);
+}
+
+
+struct benchsample {
+    string name;
+    long long nodes;
+    vector<double> nps;
+};
+
+
+static vector<double> benchJsonNumbers(string line, string key)
+{
+    vector<double> v;
+    smatch match;
+    if (regex_search(line, match, regex("\"" + key + "\": \\[([^\\]]*)\\]")))
+    {
+        vector<string> numbers = SplitString(regex_replace(match.str(1), regex(","), " ").c_str());
+        for (auto& n : numbers)
+            v.push_back(atof(n.c_str()));
+    }
+    else if (regex_search(line, match, regex("\"" + key + "\": (-?[0-9.]+)")))
+    {
+        v.push_back(atof(match.str(1).c_str()));
+    }
+    return v;
+}
+
+
+// Reads the positions and the total of a file written by -benchjson; the total is the last sample
+static vector<benchsample> benchReadJson(string filename, string *build)
+{
+    vector<benchsample> samples;
+    ifstream in(filename);
+    string line;
+    smatch match;
+    while (getline(in, line))
+    {
+        if (regex_search(line, match, regex("\"build\": \"(.*)\"")))
+            *build = match.str(1);
+        bool total = (line.find("\"total\":") != string::npos);
+        if (!total && line.find("\"name\":") == string::npos)
+            continue;
+        benchsample bs;
+        bs.name = (total ? "Total" : regex_search(line, match, regex("\"name\": \"([^\"]*)\"")) ? match.str(1) : "");
+        vector<double> nodes = benchJsonNumbers(line, "nodes");
+        bs.nodes = (nodes.size() ? (long long)nodes[0] : 0);
+        bs.nps = benchJsonNumbers(line, "nps");
+        samples.push_back(bs);
+    }
+    return samples;
+}
+
+
+static void benchMeanVariance(vector<double> &v, double *mean, double *variance)
+{
+    double sum = 0.0, sum2 = 0.0;
+    for (double x : v)
+        sum += x;
+    *mean = (v.size() ? sum / v.size() : 0.0);
+    for (double x : v)
+        sum2 += (x - *mean) * (x - *mean);
+    *variance = (v.size() > 1 ? sum2 / (v.size() - 1) : 0.0);
+}
+
+
+// Compares the nps of the current runs with the baseline; Welch's t of the means of the runs tells if a
+// difference is more than noise (|t| > 2 is roughly 95% confidence). Returns true for a significant slowdown.
+static bool benchCompare(string baselinefile, vector<list<benchmarkstruct>> &runs)
+{
+    string build = "";
+    vector<benchsample> base = benchReadJson(baselinefile, &build);
+    if (base.empty())
+    {
+        printf("Cannot read bench results from %s.\n", baselinefile.c_str());
+        return false;
+    }
+
+    vector<benchsample> current;
+    vector<list<benchmarkstruct>::iterator> it;
+    for (auto& r : runs)
+        it.push_back(r.begin());
+    benchsample total = { "Total", 0, vector<double>(runs.size(), 0.0) };
+    vector<double> totaltime(runs.size(), 0.0);
+    while (it.size() && it[0] != runs[0].end())
+    {
+        benchsample bs;
+        for (size_t r = 0; r < runs.size(); r++)
+        {
+            benchmarkstruct *bm = &*it[r]++;
+            bs.name = bm->name;
+            bs.nodes = bm->nodes;
+            bs.nps.push_back(bm->time ? (double)bm->nodes * en.frequency / bm->time : 0.0);
+            totaltime[r] += (double)bm->time / en.frequency;
+            total.nodes += (r ? 0 : bm->nodes);
+            total.nps[r] += bm->nodes;
+        }
+        current.push_back(bs);
+    }
+    for (size_t r = 0; r < runs.size(); r++)
+        total.nps[r] = (totaltime[r] > 0.0 ? total.nps[r] / totaltime[r] : 0.0);
+    current.push_back(total);
+
+    if (current.size() != base.size())
+    {
+        printf("Baseline %s has %d positions but this bench has %d.\n", baselinefile.c_str(), (int)base.size() - 1, (int)current.size() - 1);
+        return false;
+    }
+
+    printf("\nComparison with baseline %s (Build %s):\n", baselinefile.c_str(), build.c_str());
+    printf("Position              base nps   runs     curr nps   runs    delta        t\n");
+    printf("=============================================================================\n");
+    bool regression = false;
+    bool nodesdiffer = false;
+    for (size_t i = 0; i < current.size(); i++)
+    {
+        double bmean, bvar, cmean, cvar;
+        benchMeanVariance(base[i].nps, &bmean, &bvar);
+        benchMeanVariance(current[i].nps, &cmean, &cvar);
+        double delta = (bmean > 0.0 ? 100.0 * (cmean - bmean) / bmean : 0.0);
+        string t = "n/a";
+        double se = sqrt(bvar / max((size_t)1, base[i].nps.size()) + cvar / max((size_t)1, current[i].nps.size()));
+        bool significant = false;
+        if (base[i].nps.size() > 1 && current[i].nps.size() > 1 && se > 0.0)
+        {
+            double tval = (cmean - bmean) / se;
+            t = to_string(tval).substr(0, to_string(tval).find('.') + 3);
+            significant = (fabs(tval) > 2.0);
+        }
+        bool differ = (base[i].nodes != current[i].nodes);
+        nodesdiffer = nodesdiffer || differ;
+        if (i == current.size() - 1)
+        {
+            printf("-----------------------------------------------------------------------------\n");
+            regression = significant && delta < 0.0;
+        }
+        printf("%-16s %13.0f %6d %12.0f %6d %+7.2f%% %8s%s%s\n", current[i].name.c_str(), bmean, (int)base[i].nps.size(), cmean, (int)current[i].nps.size(),
+            delta, t.c_str(), significant ? " *" : "", differ ? " (nodes differ)" : "");
+    }
+    printf("* significant (|t| > 2)\n");
+    if (nodesdiffer)
+        printf("The searches differ from the baseline; nps are less comparable.\n");
+    printf("Result: %s\n", regression ? "significant nps regression" : "no significant nps regression");
+    return regression;
+}
+
+
+
+static void doSmpBenchmark(int constdepth, int maxthreads, string epdfilename)
+{
+    FILE *out = stderr;
+    long long basetime = 0, basenodes = 0;
+    maxthreads = max(1, min(maxthreads, MAXTHREADS));
+
+    // the positions of the standard bench or of an epd file
+    vector<benchmarkstruct> positions;
+    if (epdfilename != "")
+    {
+        ifstream epdfile(epdfilename);
+        if (!epdfile.is_open())
+        {
+            printf("Cannot open file %s for reading.\n", epdfilename.c_str());
+            return;
+        }
+        string line, bestmoves, avoidmoves;
+        benchmarkstruct bm = benchmarkpositions[0];
+        bm.depth = 10;  // default depth for epd bench
+        bm.terminationscore = 0;
+        while (getline(epdfile, line))
+        {
+            getFenAndBmFromEpd(line, &bm.fen, &bestmoves, &avoidmoves);
+            if (bm.fen == "")
+                continue;
+            bm.name = "Epd " + to_string(positions.size() + 1);
+            positions.push_back(bm);
+        }
+    }
+    else
+    {
+        for (int i = 0; benchmarkpositions[i].fen != ""; i++)
+            positions.push_back(benchmarkpositions[i]);
+    }
+    if (!positions.size())
+    {
+        printf("No positions for the smp benchmark.\n");
+        return;
+    }
+    vector<benchmarkstruct> baseresults;
+
+    benchTableHeader(out);
+    fprintf(out, "Positions: %d   Hash: %d MB\n", (int)positions.size(), en.Hash);
+    fprintf(out, "Agreement is relative to the single thread search: same best move / average score difference in cp\n");
+    fprintf(out, "Threads  Marking       Time          Nodes        NPS  NPS-Scaling  TTD-Speedup  Same-Move  Score-Diff\n");
+    bool oldmarking = en.smpMarking;
+    // 1, 2, 4, ... and maxthreads
+    for (int threads = 1; threads <= maxthreads; threads = (threads < maxthreads && threads * 2 > maxthreads ? maxthreads : threads * 2))
+    {
+        en.ucioptions.Set("Threads", to_string(threads));
+        for (int marking = 0; marking <= (threads > 1); marking++)
+        {
+            en.ucioptions.Set("SMPMarking", marking ? "true" : "false");
+            long long totaltime = 0, totalnodes = 0;
+            int samemove = 0;
+            long long scorediff = 0;
+            for (size_t i = 0; i < positions.size(); i++)
+            {
+                benchmarkstruct bm = positions[i];
+                benchRunPosition(&bm, constdepth, 0);
+                totaltime += bm.time;
+                totalnodes += bm.nodes;
+                if (threads == 1)
+                    baseresults.push_back(bm);
+                samemove += (bm.move == baseresults[i].move);
+                scorediff += abs(bm.score - baseresults[i].score);
+            }
+            if (threads == 1)
+            {
+                basetime = totaltime;
+                basenodes = totalnodes;
+            }
+            double nps = totalnodes * (double)en.frequency / totaltime;
+            double basenps = basenodes * (double)en.frequency / basetime;
+            fprintf(out, "%7d  %7s %10.3f %14lld %10.0f %12.2f %12.2f %9.1f%% %11.1f\n", threads, threads > 1 ? (marking ? "on" : "off") : "-",
+                totaltime / (double)en.frequency, totalnodes, nps, nps / basenps, basetime / (double)totaltime,
+                100.0 * samemove / positions.size(), scorediff / (double)positions.size());
+        }
+    }
+    en.ucioptions.Set("SMPMarking", oldmarking ? "true" : "false");
+    en.terminationscore = SHRT_MAX;
+}
+
+
+static void doLatencyBenchmark()
+{
+    const int threadnums[] = { 1, 8, 64 };
+    const int iterations = 20;
+    double usecPerTick = 1000000.0 / en.frequency;
+
+    struct {
+        int threads;
+        double firstthread;
+        double allthreads;
+        double spawned;
+    } results[3];
+
+    for (int t = 0; t < 3; t++)
+    {
+        int threads = min(threadnums[t], MAXTHREADS);
+        en.ucioptions.Set("Threads", to_string(threads));
+        en.communicate("position startpos");
+        U64 sumfirst = 0, sumall = 0, sumspawned = 0;
+        for (int i = 0; i < iterations; i++)
+        {
+            for (int tnum = 0; tnum < en.Threads; tnum++)
+                en.sthread[tnum].firstnodetime = 0;
+            en.communicate("go depth 1");
+            U64 first = ULLONG_MAX, last = 0;
+            for (int tnum = 0; tnum < en.Threads; tnum++)
+            {
+                first = min(first, en.sthread[tnum].firstnodetime);
+                last = max(last, en.sthread[tnum].firstnodetime);
+            }
+            sumfirst += first - en.starttime;
+            sumall += last - en.starttime;
+
+            // For comparison: the old way of creating new threads for every search
+            U64 spawntime[MAXTHREADS];
+            thread spawnthr[MAXTHREADS];
+            U64 spawnstart = getTime();
+            for (int tnum = 0; tnum < threads; tnum++)
+                spawnthr[tnum] = thread([](U64 *tm) { *tm = getTime(); }, &spawntime[tnum]);
+            for (int tnum = 0; tnum < threads; tnum++)
+                spawnthr[tnum].join();
+            sumspawned += *max_element(spawntime, spawntime + threads) - spawnstart;
+        }
+        results[t].threads = threads;
+        results[t].firstthread = sumfirst * usecPerTick / iterations;
+        results[t].allthreads = sumall * usecPerTick / iterations;
+        results[t].spawned = sumspawned * usecPerTick / iterations;
+    }
+
+    printf("\nLatency from go to first node in microseconds (average of %d searches)\n", iterations);
+    printf("=========================================================================\n");
+    printf("Threads   first thread   all threads   new threads (spawn until all started)\n");
+    for (int t = 0; t < 3; t++)
+        printf("%7d %14.1f %13.1f %13.1f\n", results[t].threads, results[t].firstthread, results[t].allthreads, results[t].spawned);
+}
+
+
+//
+// Microbenchmark of the core primitives
+// Every primitive is called repeatedly on each position of the corpus (the bench positions or an epd file)
+// and the time per call is reported; the setup of a position is not measured.
+//
+
+static volatile U64 microbenchsink;
+
+// Default preparation of a position: the pseudo-legal moves the search would generate
+static bool microbenchMoves(chessposition *pos, chessmovelist *moves)
+{
+    if (pos->isCheckbb)
+        moves->length = CreateEvasionMovelist(pos, &moves->move[0]);
+    else
+        moves->length = CreateMovelist<ALL>(pos, &moves->move[0]);
+    return true;
+}
+
+// Runs op reps times for every position prepare accepts; op returns the number of primitive calls it did
+template <typename P, typename T> static void microbenchRun(const char *name, vector<string> &fens, int reps, P prepare, T op)
+{
+    chessposition *pos = &en.sthread[0].pos;
+    chessmovelist moves;
+    U64 calls = 0;
+    long long ticks = 0;
+    for (auto& fen : fens)
+    {
+        if (pos->getFromFen(fen.c_str()) < 0)
+            continue;
+        pos->ply = 0;
+#ifdef NNUE
+        pos->accumulator[0].computationState = false;
+#endif
+        pos->prepareStack();
+        if (!prepare(pos, &moves))
+            continue;
+        long long start = getTime();
+        for (int r = 0; r < reps; r++)
+            calls += op(pos, &moves);
+        ticks += getTime() - start;
+    }
+    if (calls)
+        printf("%-36s %12llu %10.1f\n", name, calls, ticks * 1e9 / en.frequency / calls);
+    else
+        printf("%-36s %12s\n", name, "skipped");
+}
+
+#ifdef NNUE
+template <NnueType Nt> static void microbenchNnue(vector<string> &fens)
+{
+    // the root accumulator is computed outside of the measurement
+    auto rootAccumulator = [](chessposition *pos, chessmovelist *moves) {
+        microbenchMoves(pos, moves);
+        pos->RefreshAccumulator<Nt>();
+        return true;
+    };
+
+    microbenchRun("NNUE refresh accumulator", fens, 2000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *) {
+            pos->accumulator[pos->mstop].computationState = false;
+            pos->RefreshAccumulator<Nt>();
+            return 1;
+        });
+    microbenchRun("NNUE incremental update", fens, 2000,
+        [rootAccumulator](chessposition *pos, chessmovelist *moves) {
+            rootAccumulator(pos, moves);
+            // play a legal non-king move; king moves lead to a refresh
+            for (int i = 0; i < moves->length; i++)
+            {
+                chessmove *m = &moves->move[i];
+                if ((GETPIECE(m->code) >> 1) != KING && pos->playMove(m))
+                    return true;
+            }
+            return false;
+        },
+        [](chessposition *pos, chessmovelist *) {
+            pos->accumulator[pos->mstop].computationState = false;
+            pos->UpdateAccumulator<Nt>();
+            return 1;
+        });
+    microbenchRun("NNUE transform and propagate", fens, 2000, rootAccumulator,
+        [](chessposition *pos, chessmovelist *) {
+            microbenchsink = microbenchsink + pos->NnueGetEval<Nt>();
+            return 1;
+        });
+}
+#endif
+
+static void doMicroBenchmark(string epdfilename)
+{
+    vector<string> fens;
+    if (epdfilename != "")
+    {
+        ifstream epdfile(epdfilename);
+        string line, fen, bm, am;
+        while (getline(epdfile, line))
+        {
+            getFenAndBmFromEpd(line, &fen, &bm, &am);
+            if (fen != "")
+                fens.push_back(fen);
         }
+    }
+    else
+    {
+        for (int i = 0; benchmarkpositions[i].fen != ""; i++)
+            fens.push_back(benchmarkpositions[i].fen);
+    }
+    if (!fens.size())
+    {
+        printf("No positions for the microbenchmark.\n");
+        return;
+    }
+
+    printf("\nMicrobenchmark of the core primitives over %d positions\n", (int)fens.size());
+    printf("=======================================================\n");
+    printf("%-36s %12s %10s\n", "Primitive", "Calls", "ns/call");
+
+    microbenchRun("CreateMovelist<ALL>", fens, 20000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *moves) { microbenchsink = microbenchsink + CreateMovelist<ALL>(pos, &moves->move[0]); return 1; });
+    microbenchRun("CreateMovelist<TACTICAL>", fens, 20000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *moves) { microbenchsink = microbenchsink + CreateMovelist<TACTICAL>(pos, &moves->move[0]); return 1; });
+    microbenchRun("CreateMovelist<QUIET>", fens, 20000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *moves) { microbenchsink = microbenchsink + CreateMovelist<QUIET>(pos, &moves->move[0]); return 1; });
+    // positions in check after the first checking move
+    microbenchRun("CreateEvasionMovelist", fens, 20000,
+        [](chessposition *pos, chessmovelist *moves) {
+            microbenchMoves(pos, moves);
+            for (int i = 0; i < moves->length; i++)
+            {
+                if (!pos->playMove(&moves->move[i]))
+                    continue;
+                if (pos->isCheckbb)
+                    return true;
+                pos->unplayMove(&moves->move[i]);
+            }
+            return false;
+        },
+        [](chessposition *pos, chessmovelist *moves) { microbenchsink = microbenchsink + CreateEvasionMovelist(pos, &moves->move[0]); return 1; });
+    microbenchRun("playMove/unplayMove", fens, 2000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *moves) {
+            for (int i = 0; i < moves->length; i++)
+                if (pos->playMove(&moves->move[i]))
+                    pos->unplayMove(&moves->move[i]);
+            return moves->length;
+        });
+    microbenchRun("see", fens, 2000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *moves) {
+            for (int i = 0; i < moves->length; i++)
+                microbenchsink = microbenchsink + pos->see(moves->move[i].code, 0);
+            return moves->length;
+        });
+    microbenchRun("moveIsPseudoLegal", fens, 2000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *moves) {
+            for (int i = 0; i < moves->length; i++)
+                microbenchsink = microbenchsink + pos->moveIsPseudoLegal(moves->move[i].code);
+            return moves->length;
+        });
+    microbenchRun("shortMove2FullMove", fens, 2000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *moves) {
+            for (int i = 0; i < moves->length; i++)
+                microbenchsink = microbenchsink + pos->shortMove2FullMove((uint16_t)moves->move[i].code);
+            return moves->length;
+        });
+
+    // the pawn and material hash are hit after the first call like in most nodes of the search
+#ifdef NNUE
+    NnueType nt = NnueReady;
+    NnueReady = NnueDisabled;
+#endif
+    microbenchRun("getEval<NOTRACE> classical", fens, 20000, microbenchMoves,
+        [](chessposition *pos, chessmovelist *) { microbenchsink = microbenchsink + pos->getEval<NOTRACE>(); return 1; });
+#ifdef NNUE
+    NnueReady = nt;
+    if (NnueReady)
+    {
+        microbenchRun("getEval<NOTRACE> NNUE", fens, 2000, microbenchMoves,
+            [](chessposition *pos, chessmovelist *) {
+                pos->accumulator[pos->mstop].computationState = false;
+                microbenchsink = microbenchsink + pos->getEval<NOTRACE>();
+                return 1;
+            });
+        if (NnueReady == NnueRotate)
+            microbenchNnue<NnueRotate>(fens);
         else
+            microbenchNnue<NnueFlip>(fens);
+    }
+    else
+    {
+        printf("%-36s %12s\n", "NNUE", "skipped (no network)");
+    }
+#endif
+
+    // transposition table with random keys; the probes hit the entries stored before
+    const int ttkeys = 1 << 20;
+    vector<U64> keys(ttkeys);
+    U64 r = 0x9e3779b97f4a7c15ULL;
+    for (auto& k : keys)
+    {
+        r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+        k = r;
+    }
+    const int hashsizes[] = { 16, 256, 1024 };
+    int oldhash = en.Hash;
+    for (int h = 0; h < 3; h++)
+    {
+        en.ucioptions.Set("Hash", to_string(hashsizes[h]));
+        long long start = getTime();
+        for (int i = 0; i < ttkeys; i++)
+            tp.addHash(keys[i], i & 0xff, i & 0xff, HASHEXACT, i & 0x1f, (uint16_t)i);
+        long long storeticks = getTime() - start;
+        start = getTime();
+        for (int i = 0; i < ttkeys; i++)
+        {
+            int val, staticeval;
+            uint16_t movecode;
+            microbenchsink = microbenchsink + tp.probeHash(keys[i], &val, &staticeval, &movecode, 0, -SCOREWHITEWINS, SCOREWHITEWINS, 0);
+        }
+        long long probeticks = getTime() - start;
+        string name = "TT store  (Hash " + to_string(hashsizes[h]) + ")";
+        printf("%-36s %12d %10.1f\n", name.c_str(), ttkeys, storeticks * 1e9 / en.frequency / ttkeys);
+        name = "TT probe  (Hash " + to_string(hashsizes[h]) + ")";
+        printf("%-36s %12d %10.1f\n", name.c_str(), ttkeys, probeticks * 1e9 / en.frequency / ttkeys);
+    }
+    en.ucioptions.Set("Hash", to_string(oldhash));
+
+    // tablebases need their own corpus of endgames
+    vector<string> endgames = {
+        "8/8/8/8/3k4/8/3KP3/8 w - - 0 1",
+        "8/8/4k3/8/8/8/4K3/5Q2 w - - 0 1",
+        "8/8/8/4k3/8/8/8/2BNK3 w - - 0 1",
+        "8/5k2/8/4PK2/8/8/8/3r4 w - - 0 1",
+        "8/8/4k3/r7/8/8/3QK3/8 w - - 0 1",
+        "8/8/1k6/8/3P4/8/2KR4/6r1 w - - 0 1",
+        "8/8/1k6/2p5/3P4/8/2KR4/6r1 b - - 0 1",
+        "8/3n4/1k6/2p5/3P4/8/2KR4/6r1 w - - 0 1",
+    };
+    if (TBlargest)
+        microbenchRun("probe_wdl", endgames, 2000,
+            [](chessposition *pos, chessmovelist *) { return POPCOUNT(pos->occupied00[0] | pos->occupied00[1]) <= TBlargest; },
+            [](chessposition *pos, chessmovelist *) {
+                int success;
+                microbenchsink = microbenchsink + probe_wdl(&success, pos);
+                return 1;
+            });
+    else
+        printf("%-36s %12s\n", "probe_wdl", "skipped (no SyzygyPath)");
+}
+
+
+#ifdef COROUTINES
+// Compare nps of the regular search and the interleaved coroutine search in a single thread
+static void doCoroutineBenchmark(int msec)
+{
+    FILE *out = stderr;
+    const int tasknums[] = { 1, 2, 4, 8, 16 };
+    long long time, nodes, basenodes = 0, basetime = 0;
+
+    en.ucioptions.Set("Threads", "1");
+    for (int i = 0; benchmarkpositions[i].fen != ""; i++)
+    {
+        en.communicate("ucinewgame");
+        en.communicate("position fen " + benchmarkpositions[i].fen);
+        long long starttime = getTime();
+        en.communicate("go movetime " + to_string(msec));
+        basetime += getTime() - starttime;
+        basenodes += en.getTotalNodes();
+    }
+    double basenps = basenodes * (double)en.frequency / basetime;
+
+    benchTableHeader(out);
+    fprintf(out, "Search       Tasks        Nodes        NPS  NPS-Ratio\n");
+    fprintf(out, "regular      %5d %12lld %10.0f %10.2f\n", 1, basenodes, basenps, 1.0);
+    for (int t = 0; t < 5; t++)
+    {
+        en.ucioptions.Set("Threads", to_string(tasknums[t]));
+        time = nodes = 0;
+        for (int i = 0; benchmarkpositions[i].fen != ""; i++)
+        {
+            en.communicate("ucinewgame");
+            en.communicate("position fen " + benchmarkpositions[i].fen);
+            long long starttime = getTime();
+            nodes += coroutineSearch(tasknums[t], msec);
+            time += getTime() - starttime;
+        }
+        double nps = nodes * (double)en.frequency / time;
+        fprintf(out, "coroutines   %5d %12lld %10.0f %10.2f\n", tasknums[t], nodes, nps, nps / basenps);
+    }
+}
+#endif
+
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+// Time to depth of the benchmark positions with one process and a cluster of <nodes> local processes
+static void doClusterBenchmark(int constdepth, int nodes, const char *prgname)
+{
+    FILE *out = stderr;
+    const int maxpositions = 64;
+    long long singletime[maxpositions];
+    int numpositions = 0;
+
+    nodes = max(2, min(nodes, CLUSTERMAXNODES));
+    for (int i = 0; benchmarkpositions[i].fen != "" && i < maxpositions; i++, numpositions++)
+    {
+        benchmarkstruct bm = benchmarkpositions[i];
+        benchRunPosition(&bm, constdepth, 0);
+        singletime[i] = bm.time;
+    }
+
+    if (!cl.startMaster(0))
+    {
+        fprintf(out, "Cannot start cluster master.\n");
+        return;
+    }
+
+    string hostport = "localhost:" + to_string(cl.port);
+    pid_t pids[CLUSTERMAXNODES];
+    int numworkers = 0;
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+    for (int i = 1; i < nodes; i++)
+    {
+        char *args[] = { (char*)prgname, (char*)"-clusterworker", (char*)hostport.c_str(), nullptr };
+        if (posix_spawn(&pids[numworkers], prgname, &fa, nullptr, args, environ) == 0)
+            numworkers++;
+    }
+    posix_spawn_file_actions_destroy(&fa);
+
+    // wait up to 10 seconds for the workers to connect
+    for (int i = 0; i < 1000 && cl.numOfWorkers() < numworkers; i++)
+        Sleep(10);
+
+    benchTableHeader(out);
+    fprintf(out, "Cluster with %d processes (%d workers connected)\n", numworkers + 1, cl.numOfWorkers());
+    fprintf(out, "Position                  Depth   Time single  Time cluster   TTD-Speedup\n");
+    long long totalsingle = 0, totalcluster = 0;
+    for (int i = 0; i < numpositions; i++)
+    {
+        benchmarkstruct bm = benchmarkpositions[i];
+        benchRunPosition(&bm, constdepth, 0);
+        totalsingle += singletime[i];
+        totalcluster += bm.time;
+        fprintf(out, "%-25s %5d %13.3f %13.3f %13.2f\n", bm.name.c_str(), constdepth ? constdepth : bm.depth,
+            singletime[i] / (double)en.frequency, bm.time / (double)en.frequency, singletime[i] / (double)bm.time);
+    }
+    fprintf(out, "%-25s %5s %13.3f %13.3f %13.2f\n", "Total", "", totalsingle / (double)en.frequency,
+        totalcluster / (double)en.frequency, totalsingle / (double)totalcluster);
+
+    cl.stop();
+    for (int i = 0; i < numworkers; i++)
+        waitpid(pids[i], nullptr, 0);
+    en.terminationscore = SHRT_MAX;
+}
+
+
+// Worker mode of the cluster; connects to the master and searches until the master quits
+static void doClusterWorker(string hostport)
+{
+    if (!cl.startWorker(hostport))
+    {
+        fprintf(stderr, "Cannot connect to cluster master %s.\n", hostport.c_str());
+        return;
+    }
+    cl.workerLoop();
+}
+
+
+//
+// Parallel epd bench: the positions are solved by engine processes started with -epdworker.
+// Each process has its own hash and search threads as set by the Hash and Threads options.
+// The master sends '<index> <epd>' to the stdin of an idle worker; the worker answers with one line on fd 3.
+//
+struct epdworker {
+    pid_t pid;
+    FILE *cmd;
+    FILE *result;
+    int job;
+    bool failed;
+};
+
+
+static void doParallelEpdBenchmark(int constdepth, string epdfilename, int consttime, int startnum, int workers, const char *prgname)
+{
+    FILE *out = stderr;
+    ifstream epdfile(epdfilename);
+    if (!epdfile.is_open())
+    {
+        printf("Cannot open file %s for reading.\n", epdfilename.c_str());
+        return;
+    }
+
+    vector<string> lines;
+    string line, fen, bestmoves, avoidmoves;
+    int n = 0;
+    while (getline(epdfile, line))
+    {
+        getFenAndBmFromEpd(line, &fen, &bestmoves, &avoidmoves);
+        if (fen != "" && ++n >= startnum)
+            lines.push_back(line);
+    }
+    if (lines.empty())
+        return;
+
+    workers = max(1, min(workers, (int)lines.size()));
+    string depthstr = to_string(constdepth);
+    string timestr = to_string(consttime);
+    string threadsstr = to_string(en.Threads);
+    string hashstr = to_string(en.Hash);
+    const char *args[] = { prgname, "-epdworker", "-depth", depthstr.c_str(), "-maxtime", timestr.c_str(),
+        "-option", "Threads", threadsstr.c_str(), "-option", "Hash", hashstr.c_str(),
+#ifdef NNUE
+        "-option", "NNUENetpath", en.NnueNetpath.c_str(),
+#endif
+        nullptr };
+
+    vector<epdworker> w;
+    for (int i = 0; i < workers; i++)
+    {
+        int cmdpipe[2], resultpipe[2];
+        if (pipe(cmdpipe) < 0)
+            break;
+        if (pipe(resultpipe) < 0)
+        {
+            close(cmdpipe[0]);
+            close(cmdpipe[1]);
+            break;
+        }
+        // the ends of the master shouldn't leak into the next workers
+        fcntl(cmdpipe[1], F_SETFD, FD_CLOEXEC);
+        fcntl(resultpipe[0], F_SETFD, FD_CLOEXEC);
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_adddup2(&fa, cmdpipe[0], 0);
+        posix_spawn_file_actions_adddup2(&fa, resultpipe[1], 3);
+        posix_spawn_file_actions_addclose(&fa, cmdpipe[0]);
+        posix_spawn_file_actions_addclose(&fa, resultpipe[1]);
+        posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+        epdworker wk;
+        bool spawned = (posix_spawn(&wk.pid, prgname, &fa, nullptr, (char* const*)args, environ) == 0);
+        posix_spawn_file_actions_destroy(&fa);
+        close(cmdpipe[0]);
+        close(resultpipe[1]);
+        if (!spawned)
+        {
+            close(cmdpipe[1]);
+            close(resultpipe[0]);
+            break;
+        }
+        wk.cmd = fdopen(cmdpipe[1], "w");
+        wk.result = fdopen(resultpipe[0], "r");
+        wk.job = -1;
+        wk.failed = false;
+        w.push_back(wk);
+    }
+    if (w.empty())
+    {
+        fprintf(out, "Cannot start the worker processes.\n");
+        return;
+    }
+    // a crashed worker shouldn't kill the master
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(out, "Solving %d positions with %d processes of %d thread(s) and %d MB hash each\n", (int)lines.size(), (int)w.size(), en.Threads, en.Hash);
+    vector<benchmarkstruct> results(lines.size());
+    vector<bool> finished(lines.size(), false);
+    size_t next = 0;
+    int running = 0;
+    long long starttime = getTime();
+
+    auto assign = [&](epdworker& wk) {
+        wk.job = -1;
+        if (next < lines.size())
         {
-            // read positions from epd file
-            bm = &epdbm;
-            string line;
-            getline(epdfile, line);
-            getFenAndBmFromEpd(line, &bm->fen, &bestmoves, &avoidmoves);
+            fprintf(wk.cmd, "%d %s\n", (int)next, lines[next].c_str());
+            fflush(wk.cmd);
+            wk.job = (int)next++;
+            running++;
+        }
+    };
+    for (auto& wk : w)
+        assign(wk);
 
+    while (running)
+    {
+        vector<pollfd> fds;
+        vector<epdworker*> busy;
+        for (auto& wk : w)
+            if (wk.job >= 0)
+            {
+                fds.push_back({ fileno(wk.result), POLLIN, 0 });
+                busy.push_back(&wk);
+            }
+        if (poll(fds.data(), fds.size(), -1) <= 0)
+            continue;
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (!fds[i].revents)
+                continue;
+            epdworker *wk = busy[i];
+            running--;
+            char buf[256];
+            int index, solved, score, depth, pos = 0;
+            long long time, nodes;
+            if (!fgets(buf, sizeof(buf), wk->result)
+                || sscanf(buf, "%d %d %d %d %lld %lld %n", &index, &solved, &score, &depth, &time, &nodes, &pos) < 6
+                || index != wk->job)
+            {
+                // the worker died; don't give it more work
+                fprintf(out, "Worker %d failed at position %d.\n", (int)wk->pid, wk->job + startnum);
+                wk->job = -1;
+                wk->failed = true;
+                continue;
+            }
+            benchmarkstruct *bm = &results[index];
             bm->depth = 10;  // default depth for epd bench
-            bm->terminationscore = 0;
+            bm->solved = solved;
+            bm->score = score;
+            bm->depthAtExit = depth;
+            bm->time = max(1LL, time);
+            bm->nodes = nodes;
+            bm->move = string(buf + pos);
+            bm->move.erase(bm->move.find_last_not_of("\r\n") + 1);
+            finished[index] = true;
+            benchTableItem(out, index + startnum, bm);
+            assign(*wk);
         }
-        if (bm->fen == "") break;
-
-        if (++i < startnum) continue;
-
-        en.communicate("ucinewgame");
-        en.communicate("position fen " + bm->fen);
-        starttime = getTime();
-        int dp = 0;
-        int tm = consttime;
-        if (constdepth)
-            dp = constdepth;
-        else
-            dp = bm->depth;
-        if (bm->terminationscore)
-            en.terminationscore = bm->terminationscore;
-        else
-            en.terminationscore = SHRT_MAX;
-        if (tm)
-            en.communicate("go movetime " + to_string(tm * 1000));
-        else if (dp)
-            en.communicate("go depth " + to_string(dp));
-        else
-            en.communicate("go infinite");
-
-        endtime = getTime();
-        bm->time = endtime - starttime;
-        bm->nodes = en.getTotalNodes();
-        bm->score = en.rootposition.lastbestmovescore;
-        bm->depthAtExit = en.benchdepth;
-        bm->move = en.benchmove;
-        bm->solved = 2;
-
-        if (bestmoves != "")
-            bm->solved = (bestmoves.find(bm->move) != string::npos) ? 1 : 0;
-        if (avoidmoves != "")
-            bm->solved = (bestmoves.find(bm->move) != string::npos) ? 0 : 1;
-        if (bm->solved < 2)
-            totalSolved[bm->solved]++;
-
-        if (bGetFromEpd)
-            benchTableItem(tableout, i, bm);
+    }
+    long long walltime = getTime() - starttime;
 
-        bmlist.push_back(*bm);
+    for (auto& wk : w)
+    {
+        if (!wk.failed)
+            fprintf(wk.cmd, "quit\n");
+        fclose(wk.cmd);
+        fclose(wk.result);
+        waitpid(wk.pid, nullptr, 0);
     }
 
-    en.terminationscore = SHRT_MAX;
-    i = 0;
+    // the results in the order of the epd file
+    int totalSolved[2] = { 0 };
     long long totaltime = 0;
     long long totalnodes = 0;
-    benchTableHeader(tableout);
-
-    for (list<benchmarkstruct>::iterator bm = bmlist.begin(); bm != bmlist.end(); bm++)
+    benchTableHeader(out);
+    for (size_t i = 0; i < results.size(); i++)
     {
+        if (!finished[i])
+        {
+            fprintf(out, "Bench # %3d: not solved because of a failed worker\n", (int)i + startnum);
+            continue;
+        }
+        benchmarkstruct *bm = &results[i];
+        if (bm->solved < 2)
+            totalSolved[bm->solved]++;
         totaltime += bm->time;
         totalnodes += bm->nodes;
-        benchTableItem(tableout, ++i, &*bm);
+        benchTableItem(out, (int)i + startnum, bm);
     }
     if (totaltime)
+        benchTableFooder(out, totaltime, totalnodes, totalSolved);
+    fprintf(out, "Wall time: %10f sec. with %d processes (speedup %.2f)\n", walltime / (double)en.frequency, (int)w.size(),
+        totaltime / (double)max(1LL, walltime));
+    en.terminationscore = SHRT_MAX;
+}
+
+
+// Worker process of the parallel epd bench
+static void doEpdWorker(int constdepth, int consttime)
+{
+    FILE *result = fdopen(3, "w");
+    if (!result)
+        return;
+
+    string line;
+    while (getline(cin, line) && line != "quit")
     {
-        benchTableFooder(tableout, totaltime, totalnodes, totalSolved);
-        if (openbench)
-            printf("Time  : %lld\nNodes : %lld\nNPS   : %lld\n", totaltime * 1000 / en.frequency, totalnodes, totalnodes * en.frequency / totaltime);
+        size_t sp = line.find(' ');
+        if (sp == string::npos)
+            continue;
+        int index = atoi(line.c_str());
+        benchmarkstruct bm = {};
+        string bestmoves, avoidmoves;
+        getFenAndBmFromEpd(line.substr(sp + 1), &bm.fen, &bestmoves, &avoidmoves);
+        bm.depth = 10;  // default depth for epd bench
+        bm.terminationscore = 0;
+        benchRunPosition(&bm, constdepth, consttime);
+        fprintf(result, "%d %d %d %d %lld %lld %s\n", index, benchSolved(bm.move, bestmoves, avoidmoves), bm.score, bm.depthAtExit, bm.time, bm.nodes, bm.move.c_str());
+        fflush(result);
     }
+    fclose(result);
 }
 
+#endif
+
+
+//
+// Bulk testing of uci engines with epd files; the engines run as child processes connected by pipes.
+// With concurrency > 1 several positions are tested at the same time, each by its own set of engine processes.
+//
 
+// A uci engine process with pipes to its stdin and stdout
+class engineprocess
+{
+#ifdef _WIN32
+    HANDLE inwrite = NULL;
+    HANDLE outread = NULL;
+#else
+    pid_t pid = 0;
+    int infd = -1;
+    int outfd = -1;
+#endif
+public:
+    bool start(string cmd);
+    bool write(const char *s);
+    int read(char *buf, int size);
+    void closeInput();
+    void wait();
+};
 
 #ifdef _WIN32
 
-static void readfromengine(HANDLE pipe, enginestate *es)
+bool engineprocess::start(string cmd)
+{
+    HANDLE inread, outwrite;
+    SECURITY_ATTRIBUTES sa;
+    sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+    sa.bInheritHandle = TRUE;
+    sa.lpSecurityDescriptor = NULL;
+
+    if (!CreatePipe(&outread, &outwrite, &sa, 0)
+        || !SetHandleInformation(outread, HANDLE_FLAG_INHERIT, 0)
+        || !CreatePipe(&inread, &inwrite, &sa, 0)
+        || !SetHandleInformation(inwrite, HANDLE_FLAG_INHERIT, 0))
+    {
+        printf("Cannot pipe connection to engine process.\n");
+        return false;
+    }
+
+    PROCESS_INFORMATION piProcInfo;
+    STARTUPINFO siStartInfo;
+    ZeroMemory(&piProcInfo, sizeof(PROCESS_INFORMATION));
+    ZeroMemory(&siStartInfo, sizeof(STARTUPINFO));
+    siStartInfo.cb = sizeof(STARTUPINFO);
+    siStartInfo.hStdError = outwrite;
+    siStartInfo.hStdOutput = outwrite;
+    siStartInfo.hStdInput = inread;
+    siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
+
+    BOOL bSuccess = CreateProcess(NULL, (LPSTR)cmd.c_str(), NULL, NULL, TRUE, 0, NULL, NULL, &siStartInfo, &piProcInfo);
+    // the child has its own handles now; closing ours lets ReadFile fail when the engine exits
+    CloseHandle(outwrite);
+    CloseHandle(inread);
+    if (!bSuccess)
+    {
+        printf("Cannot create process for engine %s.\n", cmd.c_str());
+        return false;
+    }
+    CloseHandle(piProcInfo.hProcess);
+    CloseHandle(piProcInfo.hThread);
+    return true;
+}
+
+bool engineprocess::write(const char *s)
+{
+    DWORD written;
+    return WriteFile(inwrite, s, (DWORD)strlen(s), &written, NULL);
+}
+
+int engineprocess::read(char *buf, int size)
 {
     DWORD dwRead;
-    CHAR chBuf[BUFSIZE];
+    if (!ReadFile(outread, buf, size, &dwRead, NULL))
+        return -1;
+    return (int)dwRead;
+}
+
+void engineprocess::closeInput()
+{
+    if (inwrite)
+        CloseHandle(inwrite);
+    inwrite = NULL;
+}
+
+void engineprocess::wait()
+{
+    if (outread)
+        CloseHandle(outread);
+    outread = NULL;
+}
+
+#else
+
+bool engineprocess::start(string cmd)
+{
+    int inpipe[2], outpipe[2];
+    if (pipe(inpipe) < 0)
+        return false;
+    if (pipe(outpipe) < 0)
+    {
+        close(inpipe[0]);
+        close(inpipe[1]);
+        printf("Cannot pipe connection to engine process.\n");
+        return false;
+    }
+    // our ends shouldn't leak into other engines
+    fcntl(inpipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(outpipe[0], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, inpipe[0], 0);
+    posix_spawn_file_actions_adddup2(&fa, outpipe[1], 1);
+    posix_spawn_file_actions_adddup2(&fa, outpipe[1], 2);
+    posix_spawn_file_actions_addclose(&fa, inpipe[0]);
+    posix_spawn_file_actions_addclose(&fa, outpipe[1]);
+    // the shell splits the command line like CreateProcess does on Windows
+    string shellcmd = "exec " + cmd;
+    char *args[] = { (char*)"/bin/sh", (char*)"-c", (char*)shellcmd.c_str(), nullptr };
+    bool spawned = (posix_spawn(&pid, "/bin/sh", &fa, nullptr, args, environ) == 0);
+    posix_spawn_file_actions_destroy(&fa);
+    close(inpipe[0]);
+    close(outpipe[1]);
+    infd = inpipe[1];
+    outfd = outpipe[0];
+    if (!spawned)
+    {
+        printf("Cannot create process for engine %s.\n", cmd.c_str());
+        closeInput();
+        wait();
+        return false;
+    }
+    return true;
+}
+
+bool engineprocess::write(const char *s)
+{
+    size_t length = strlen(s);
+    while (length)
+    {
+        ssize_t n = ::write(infd, s, length);
+        if (n <= 0)
+            return false;
+        s += n;
+        length -= n;
+    }
+    return true;
+}
+
+int engineprocess::read(char *buf, int size)
+{
+    ssize_t n;
+    while ((n = ::read(outfd, buf, size)) < 0 && errno == EINTR);
+    return (int)n;
+}
+
+void engineprocess::closeInput()
+{
+    if (infd >= 0)
+        close(infd);
+    infd = -1;
+}
+
+void engineprocess::wait()
+{
+    if (pid > 0)
+        waitpid(pid, nullptr, 0);
+    pid = 0;
+    if (outfd >= 0)
+        close(outfd);
+    outfd = -1;
+}
+
+#endif
+
+
+static void readfromengine(engineprocess *ep, enginestate *es)
+{
+    int n;
+    char chBuf[BUFSIZE];
+    string pending;
     vector<string> lines, token;
 
-    do
+    while ((n = ep->read(chBuf, BUFSIZE)) > 0)
     {
-        memset(chBuf, 0, BUFSIZE);
-        ReadFile(pipe, chBuf, BUFSIZE, &dwRead, NULL);
-        stringstream ss(chBuf);
+        // only parse complete lines; the rest waits for the next read
+        pending.append(chBuf, n);
+        size_t end = pending.rfind('\n');
+        if (end == string::npos)
+            continue;
+        stringstream ss(pending.substr(0, end + 1));
+        pending.erase(0, end + 1);
         string line;
 
         while (getline(ss, line)) {
@@ -617,13 +2052,11 @@ static void readfromengine(HANDLE pipe, enginestate *es)
                             {
                                 if (es->firstbesttimesec < 0)
                                 {
-                                    es->firstbesttimesec = (clock() - es->starttime) / CLOCKS_PER_SEC;
-                                    //printf("%d %d  %d\n", es->firstbesttimesec, es->starttime, clock());
+                                    es->firstbesttimesec = (int)((getTime() - es->starttime) / en.frequency);
                                 }
                             }
                             else {
                                 es->firstbesttimesec = -1;
-                                //printf("%d %d  %d\n", es->firstbesttimesec, es->starttime, clock());
                             }
                         }
                     }
@@ -632,39 +2065,216 @@ static void readfromengine(HANDLE pipe, enginestate *es)
                 }
             }
         }
-    } while (true);
+    }
+    // the engine is gone; don't let the tester wait for it
+    es->dead = true;
+}
+
+
+// One position of the epd file with the results of the compare file
+struct enginetestjob {
+    int linenum;
+    string fen;
+    string bestmoves;
+    string avoidmoves;
+    bool doCompare;
+    bool comparesuccess;
+    int comparescore;
+    int comparetime;
+};
+
+struct enginetestcontext {
+    string engineprg[4];
+    int numEngines;
+    int maxtime;
+    int flags;
+    vector<enginetestjob> jobs;
+    atomic<size_t> nextjob;
+    mutex outputmutex;
+    ofstream logfile;
+};
+
+
+// Starts engine i of a slot together with its reader thread
+static void testengineStart(enginetestcontext *tc, int i, engineprocess *ep, enginestate *es, thread *readThread)
+{
+    es->phase = 0;
+    es->dead = !ep->start(tc->engineprg[i]);
+    if (!es->dead)
+        *readThread = thread(&readfromengine, ep, es);
 }
 
-static BOOL writetoengine(HANDLE pipe, const char *s)
+
+static void testengineStop(engineprocess *ep, thread *readThread)
 {
-    DWORD written;
-    return WriteFile(pipe, s, (DWORD)strlen(s), &written, NULL);
+    ep->write("quit\n");
+    ep->closeInput();
+    if (readThread->joinable())
+        readThread->join();
+    ep->wait();
 }
 
-static void testengine(string epdfilename, int startnum, string engineprgs, string logfilename, string comparefilename, int maxtime, int flags)
+
+// Tests the positions of the queue with its own set of engine processes
+static void testengineSlot(enginetestcontext *tc)
 {
     enginestate es[4];
-    enginestate ges;
-    string engineprg[4];
-    int numEngines = 0;
+    engineprocess ep[4];
+    thread readThread[4];
+    bool broken[4] = { false };     // engine cannot be (re)started; all its results are failed
+    char buf[1024];
+    int sleepDelay = 10;
+    bool doEval = (tc->flags & 0x08);
+    int numEngines = tc->numEngines;
+
+    for (int i = 0; i < numEngines; i++)
+    {
+        es[i].doEval = doEval;
+        testengineStart(tc, i, &ep[i], &es[i], &readThread[i]);
+        broken[i] = es[i].dead;
+    }
+
+    size_t j;
+    while ((j = tc->nextjob++) < tc->jobs.size())
+    {
+        enginetestjob *job = &tc->jobs[j];
+        for (int i = 0; i < numEngines; i++)
+        {
+            // Initialize the engine
+            es[i].bestmoves = job->bestmoves;
+            es[i].avoidmoves = job->avoidmoves;
+            es[i].doCompare = job->doCompare;
+            es[i].comparescore = job->comparescore;
+            es[i].comparesuccess = job->comparesuccess;
+            es[i].comparetime = job->comparetime;
+            es[i].score = SCOREBLACKWINS;
+            es[i].allscore = SCOREBLACKWINS;
+            es[i].enginesbestmove = "";
+            es[i].firstbesttimesec = -1;
+
+            if (es[i].dead && !broken[i])
+            {
+                // the engine died during the last position; replace it
+                {
+                    lock_guard<mutex> lock(tc->outputmutex);
+                    printf("Engine %s terminated; restarting it.\n", tc->engineprg[i].c_str());
+                }
+                testengineStop(&ep[i], &readThread[i]);
+                testengineStart(tc, i, &ep[i], &es[i], &readThread[i]);
+            }
+            if (broken[i] || es[i].dead)
+                continue;
+
+            es[i].phase = 0;
+            if (!ep[i].write("uci\n"))
+                es[i].dead = true;
+            while (es[i].phase == 0 && !es[i].dead)
+                Sleep(sleepDelay);
+            if (es[i].phase == 0)
+            {
+                // died before even answering uci; don't try again
+                broken[i] = true;
+                continue;
+            }
+            if (!ep[i].write("ucinewgame\n") || !ep[i].write("isready\n"))
+                es[i].dead = true;
+            while (es[i].phase == 1 && !es[i].dead)
+                Sleep(sleepDelay);
+
+            es[i].starttime = getTime();
+            es[i].firstbesttimesec = -1;
+
+            snprintf(buf, sizeof(buf), "position fen %s 0 1\n%s\n", job->fen.c_str(), doEval ? "eval" : "go infinite");
+
+            if (!es[i].dead && !ep[i].write(buf))
+                es[i].dead = true;
+        }
+
+        for (int i = 0; i < numEngines; i++)
+        {
+            bool engineStopped = false;
+            while (es[i].phase < 3 && !es[i].dead && !broken[i])
+            {
+                Sleep(sleepDelay);
+                long long elapsedsec = (getTime() - es[i].starttime) / en.frequency;
+                if (!engineStopped
+                    && (elapsedsec > tc->maxtime
+                        || es[i].score > SCOREWHITEWINS - MAXDEPTH
+                        || ((tc->flags & 0x2) && es[i].doCompare && es[i].comparesuccess && elapsedsec > es[i].comparetime)
+                        || ((tc->flags & 0x2) && es[i].firstbesttimesec >= 0 && elapsedsec > es[i].firstbesttimesec + 5)))
+                {
+                    if (!ep[i].write("stop\n"))
+                        es[i].dead = true;
+                    engineStopped = true;
+                }
+            }
+            if (es[i].phase < 3)
+            {
+                // the engine died before it finished this position
+                es[i].firstbesttimesec = -1;
+                if (es[i].enginesbestmove == "")
+                    es[i].enginesbestmove = "(dead)";
+            }
+        }
+
+        // the output of a position is written in one piece
+        lock_guard<mutex> lock(tc->outputmutex);
+        int linenum = job->linenum;
+        if (!doEval)
+        {
+            for (int i = 0; i < numEngines; i++)
+            {
+                if (es[i].firstbesttimesec >= 0)
+                {
+                    printf("e#%d  %d  %s: %s  found: %s  score: %d  time: %d\n", i, linenum, (es[i].bestmoves != "" ? "bm" : "am"), (es[i].bestmoves != "" ? es[i].bestmoves.c_str() : es[i].avoidmoves.c_str()), es[i].enginesbestmove.c_str(), es[i].score, es[i].firstbesttimesec);
+                    tc->logfile << "e#" << i << " " << linenum << " + \"" << (es[i].bestmoves != "" ? es[i].bestmoves.c_str() : (es[i].avoidmoves + "(a)").c_str()) << "\" " << es[i].enginesbestmove.c_str() << " " << es[i].score << " " << es[i].firstbesttimesec << "\n";
+
+                }
+                else
+                {
+                    printf("e#%d  %d  %s: %s  found: %s ... failed  score: %d\n", i, linenum, (es[i].bestmoves != "" ? "bm" : "am"), (es[i].bestmoves != "" ? es[i].bestmoves.c_str() : es[i].avoidmoves.c_str()), es[i].enginesbestmove.c_str(), es[i].allscore);
+                    tc->logfile << "e#" << i << " " << linenum << " - \"" << (es[i].bestmoves != "" ? es[i].bestmoves.c_str() : (es[i].avoidmoves + "(a)").c_str()) << "\" " << es[i].enginesbestmove.c_str() << " " << es[i].allscore << "\n";
+                }
+            }
+        }
+        else
+        {
+            printf("\"%s\" ", job->fen.c_str());
+            tc->logfile << "\"" << job->fen << "\" ";
+            for (int i = 0; i < numEngines; i++)
+            {
+                printf("%5d ", es[i].score);
+                tc->logfile << es[i].score << " ";
+            }
+            printf("\n");
+            tc->logfile << "\n";
+        }
+    }
+
+    for (int i = 0; i < numEngines; i++)
+        testengineStop(&ep[i], &readThread[i]);
+}
+
+
+static void testengine(string epdfilename, int startnum, string engineprgs, string logfilename, string comparefilename, int maxtime, int flags, int concurrency)
+{
+    enginetestcontext tc;
     string line;
-    thread *readThread[4];
     ifstream comparefile;
     bool compare = false;
-    char buf[1024];
     bool doEval = (flags & 0x08);
-    while (engineprgs != "" && numEngines < 4)
+    tc.numEngines = 0;
+    while (engineprgs != "" && tc.numEngines < 4)
     {
         size_t i = engineprgs.find('*');
-        engineprg[numEngines] = (i == string::npos) ? engineprgs : engineprgs.substr(0, i);
+        tc.engineprg[tc.numEngines++] = (i == string::npos) ? engineprgs : engineprgs.substr(0, i);
         engineprgs = (i == string::npos) ? "" : engineprgs.substr(i + 1, string::npos);
-        es[numEngines++].doEval = (flags & 0x08);
     }
 
-    int sleepDelay = 10;
-
     // Default time for enginetest: 30s
     if (!maxtime) maxtime = 30;
+    tc.maxtime = maxtime;
+    tc.flags = flags;
     // Open the epd file for reading
     ifstream epdfile(epdfilename);
     if (!epdfile.is_open())
@@ -688,207 +2298,107 @@ static void testengine(string epdfilename, int startnum, string engineprgs, stri
     // Open the log file for writing
     if (logfilename == "")
         logfilename = epdfilename + ".log";
-    ofstream logfile(logfilename, ios_base::app);
-    logfile.setf(ios_base::unitbuf);
-    if (!logfile.is_open())
+    tc.logfile.open(logfilename, ios_base::app);
+    tc.logfile.setf(ios_base::unitbuf);
+    if (!tc.logfile.is_open())
     {
         printf("Cannot open %s.\n", logfilename.c_str());
         return;
     }
     if (!doEval)
-        logfile << "num passed bestmove foundmove score time\n";
+        tc.logfile << "num passed bestmove foundmove score time\n";
     else
-        logfile << "fen eval\n";
-
-    // Start the engine with linked pipes
-    HANDLE g_hChildStd_IN_Rd[4] = { NULL };
-    HANDLE g_hChildStd_IN_Wr[4] = { NULL };
-    HANDLE g_hChildStd_OUT_Rd[4] = { NULL };
-    HANDLE g_hChildStd_OUT_Wr[4] = { NULL };
-    BOOL bSuccess;
-    for (int i = 0; i < numEngines; i++)
-    {
-        SECURITY_ATTRIBUTES sa;
-        sa.nLength = sizeof(SECURITY_ATTRIBUTES);
-        sa.bInheritHandle = TRUE;
-        sa.lpSecurityDescriptor = NULL;
+        tc.logfile << "fen eval\n";
 
-        if (!CreatePipe(&g_hChildStd_OUT_Rd[i], &g_hChildStd_OUT_Wr[i], &sa, 0)
-            || !SetHandleInformation(g_hChildStd_OUT_Rd[i], HANDLE_FLAG_INHERIT, 0)
-            || !CreatePipe(&g_hChildStd_IN_Rd[i], &g_hChildStd_IN_Wr[i], &sa, 0)
-            || !SetHandleInformation(g_hChildStd_IN_Wr[i], HANDLE_FLAG_INHERIT, 0))
+    // Read the compare file; the results of the positions may come in any order with concurrency
+    map<int, vector<string>> compareresults;
+    while (compare && getline(comparefile, line))
+    {
+        vector<string> cv = SplitString(line.c_str());
+        // results of the first engine of a log written by -enginetest start with e#0
+        if (cv.size() && cv[0].compare(0, 2, "e#") == 0)
         {
-            printf("Cannot pipe connection to engine process.\n");
-            return;
+            if (cv[0] != "e#0")
+                continue;
+            cv.erase(cv.begin());
         }
-
-        PROCESS_INFORMATION piProcInfo;
-        STARTUPINFO siStartInfo;
-        bSuccess = FALSE;
-        ZeroMemory(&piProcInfo, sizeof(PROCESS_INFORMATION));
-        ZeroMemory(&siStartInfo, sizeof(STARTUPINFO));
-        siStartInfo.cb = sizeof(STARTUPINFO);
-        siStartInfo.hStdError = g_hChildStd_OUT_Wr[i];
-        siStartInfo.hStdOutput = g_hChildStd_OUT_Wr[i];
-        siStartInfo.hStdInput = g_hChildStd_IN_Rd[i];
-        siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
-
-        bSuccess = CreateProcess(NULL, (LPSTR)engineprg[i].c_str(), NULL, NULL, TRUE, 0, NULL, NULL, &siStartInfo, &piProcInfo);
-        if (!bSuccess)
+        if (cv.size() < 2)
+            continue;
+        try
         {
-            printf("Cannot create process for engine %s.\n", engineprg[i].c_str());
-            return;
+            int compareindex = stoi(cv[0]);
+            if (compareresults.find(compareindex) == compareresults.end())
+                compareresults[compareindex] = cv;
         }
-        CloseHandle(piProcInfo.hProcess);
-        CloseHandle(piProcInfo.hThread);
-        readThread[i] = new thread(&readfromengine, g_hChildStd_OUT_Rd[i], &es[i]);
+        catch (const invalid_argument&) {}
     }
+
     // Read epd line by line
     int linenum = 0;
     while (getline(epdfile, line))
     {
-        string fenstr;
-        getFenAndBmFromEpd(line, &fenstr, &(ges.bestmoves), &(ges.avoidmoves));
+        enginetestjob job;
+        getFenAndBmFromEpd(line, &job.fen, &job.bestmoves, &job.avoidmoves);
 
-        if (fenstr != "" && ++linenum >= startnum)
+        if (job.fen != "" && ++linenum >= startnum)
         {
             if (doEval)
             {
                 // Skip positions with check
-                en.sthread[0].pos.getFromFen(fenstr.c_str());
+                en.sthread[0].pos.getFromFen(job.fen.c_str());
                 if (en.sthread[0].pos.isCheckbb)
                     continue;
-                fenstr = en.sthread[0].pos.toFen();
+                job.fen = en.sthread[0].pos.toFen();
             }
+            job.linenum = linenum;
 
             // Get data from compare file
-            ges.doCompare = false;
-            if (compare)
+            job.doCompare = false;
+            job.comparesuccess = false;
+            job.comparescore = SCOREBLACKWINS;
+            job.comparetime = -1;
+            auto cr = compareresults.find(linenum);
+            if (cr != compareresults.end())
             {
-                vector<string> cv;
-                string compareline;
-                int compareindex = 0;
-                while (compareindex != linenum && getline(comparefile, compareline, '\n'))
+                vector<string> &cv = cr->second;
+                job.doCompare = true;
+                job.comparesuccess = (cv[1] == "+");
+                if (cv.size() > 4)
                 {
-                    cv = SplitString(compareline.c_str());
                     try
                     {
-                        compareindex = stoi(cv[0]);
+                        job.comparescore = stoi(cv[4]);
                     }
                     catch (const invalid_argument&) {}
-
-                }
-                if (compareindex == linenum)
-                {
-                    ges.doCompare = true;
-                    ges.comparesuccess = (cv[1] == "+");
-                    ges.comparescore = SCOREBLACKWINS;
-                    ges.comparetime = -1;
-                    if (cv.size() > 4)
-                    {
-                        try
-                        {
-                            ges.comparescore = stoi(cv[4]);
-                        }
-                        catch (const invalid_argument&) {}
-                    }
-                    if (cv.size() > 5)
-                    {
-                        try
-                        {
-                            ges.comparetime = stoi(cv[5]);
-                        }
-                        catch (const invalid_argument&) {}
-                        if (ges.comparetime == 0 && (flags & 0x1))
-                            // nothing to improve; skip this test
-                            continue;
-                    }
-                }
-            }
-            for (int i = 0; i < numEngines; i++)
-            {
-                // Initialize the engine
-                es[i].bestmoves = ges.bestmoves;
-                es[i].avoidmoves = ges.avoidmoves;
-                es[i].doCompare = ges.doCompare;
-                es[i].comparescore = ges.comparescore;
-                es[i].comparesuccess = ges.comparesuccess;
-                es[i].comparetime = ges.comparetime;
-                es[i].phase = 0;
-                es[i].score = SCOREBLACKWINS;
-
-                bSuccess = writetoengine(g_hChildStd_IN_Wr[i], "uci\n");
-                while (es[i].phase == 0)
-                    Sleep(sleepDelay);
-                bSuccess = writetoengine(g_hChildStd_IN_Wr[i], "ucinewgame\n");
-                bSuccess = writetoengine(g_hChildStd_IN_Wr[i], "isready\n");
-                while (es[i].phase == 1)
-                    Sleep(sleepDelay);
-
-                es[i].starttime = clock();
-                es[i].firstbesttimesec = -1;
-
-                sprintf_s(buf, "position fen %s 0 1\n%s\n", fenstr.c_str(), doEval ? "eval" : "go infinite");
-
-                bSuccess = writetoengine(g_hChildStd_IN_Wr[i], buf);
-            }
-
-            for (int i = 0; i < numEngines; i++)
-            {
-                bool engineStopped = false;
-                while (es[i].phase < 3)
-                {
-                    Sleep(sleepDelay);
-                    clock_t now = clock();
-                    if (!engineStopped
-                        && ((now - es[i].starttime) / CLOCKS_PER_SEC > maxtime
-                            || es[i].score > SCOREWHITEWINS - MAXDEPTH
-                            || ((flags & 0x2) && es[i].doCompare && es[i].comparesuccess && (now - es[i].starttime) / CLOCKS_PER_SEC > es[i].comparetime)
-                            || ((flags & 0x2) && es[i].firstbesttimesec >= 0 && ((now - es[i].starttime) / CLOCKS_PER_SEC) > es[i].firstbesttimesec + 5)))
-                    {
-                        bSuccess = writetoengine(g_hChildStd_IN_Wr[i], "stop\n");
-                        engineStopped = true;
-                    }
                 }
-                if (!doEval)
+                if (cv.size() > 5)
                 {
-                    if (es[i].firstbesttimesec >= 0)
-                    {
-                        printf("e#%d  %d  %s: %s  found: %s  score: %d  time: %d\n", i, linenum, (es[i].bestmoves != "" ? "bm" : "am"), (es[i].bestmoves != "" ? es[i].bestmoves.c_str() : es[i].avoidmoves.c_str()), es[i].enginesbestmove.c_str(), es[i].score, es[i].firstbesttimesec);
-                        logfile << "e#" << i << " " << linenum << " + \"" << (es[i].bestmoves != "" ? es[i].bestmoves.c_str() : (es[i].avoidmoves + "(a)").c_str()) << "\" " << es[i].enginesbestmove.c_str() << " " << es[i].score << " " << es[i].firstbesttimesec << "\n";
-
-                    }
-                    else
+                    try
                     {
-                        printf("e#%d  %d  %s: %s  found: %s ... failed  score: %d\n", i, linenum, (es[i].bestmoves != "" ? "bm" : "am"), (es[i].bestmoves != "" ? es[i].bestmoves.c_str() : es[i].avoidmoves.c_str()), es[i].enginesbestmove.c_str(), es[i].allscore);
-                        logfile << "e#" << i << " " << linenum << " - \"" << (es[i].bestmoves != "" ? es[i].bestmoves.c_str() : (es[i].avoidmoves + "(a)").c_str()) << "\" " << es[i].enginesbestmove.c_str() << " " << es[i].allscore << "\n";
+                        job.comparetime = stoi(cv[5]);
                     }
+                    catch (const invalid_argument&) {}
+                    if (job.comparetime == 0 && (flags & 0x1))
+                        // nothing to improve; skip this test
+                        continue;
                 }
             }
-
-            if (doEval)
-            {
-                printf("\"%s\" ", fenstr.c_str());
-                logfile << "\"" << fenstr << "\" ";
-                for (int i = 0; i < numEngines; i++)
-                {
-                    printf("%5d ", es[i].score);
-                    logfile << es[i].score << " ";
-                }
-                printf("\n");
-                logfile << "\n";
-            }
+            tc.jobs.push_back(job);
         }
     }
-    for (int i = 0; i < numEngines; i++)
-    {
-        bSuccess = writetoengine(g_hChildStd_IN_Wr[i], "quit\n");
-        readThread[i]->detach();
-        delete readThread[i];
-    }
-}
 
-#endif // _WIN32
+#ifndef _WIN32
+    // a crashed engine shouldn't kill the tester
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    tc.nextjob = 0;
+    concurrency = max(1, min(concurrency, (int)tc.jobs.size()));
+    vector<thread> slots;
+    for (int i = 0; i < concurrency; i++)
+        slots.push_back(thread(&testengineSlot, &tc));
+    for (auto& t : slots)
+        t.join();
+}
 
 
 int main(int argc, char* argv[])
@@ -898,6 +2408,19 @@ int main(int argc, char* argv[])
     bool verbose;
     bool benchmark;
     bool openbench;
+    bool perfcount;
+    string benchjson;
+    string benchcompare;
+    int benchruns;
+    bool latencybench;
+    bool microbench;
+    bool smpbench;
+    int maxthreads;
+    int clusterbench;
+    string clusterworker;
+#ifdef COROUTINES
+    int corobench;
+#endif
     int depth;
     bool dotests;
     bool enginetest;
@@ -906,8 +2429,14 @@ int main(int argc, char* argv[])
     string logfile;
     string comparefile;
     string genepd;
+    string traceanalyze;
+    string timeloganalyze;
     int maxtime;
     int flags;
+    int retval = 0;
+    int epdworkers;
+    int concurrency;
+    bool epdworker;
 
     struct arguments {
         const char *cmd;
@@ -919,19 +2448,37 @@ int main(int argc, char* argv[])
         { "-verbose", "Show the parameterlist and actuel values.", &verbose, 0, NULL },
         { "-bench", "Do benchmark test for some positions.", &benchmark, 0, NULL },
         { "bench", "Do benchmark with OpenBench compatible output.", &openbench, 0, NULL },
+        { "-benchjson", "Write the results of the bench as json to <file> (use with -bench)", &benchjson, 2, "" },
+        { "-benchcompare", "Compare the nps of the bench with a json baseline written by -benchjson; exit code 1 for a significant regression (use with -bench)", &benchcompare, 2, "" },
+        { "-benchruns", "Repeat the bench <n> times for -benchjson and -benchcompare", &benchruns, 1, "1" },
+        { "-perfcounters", "Measure cycles, instructions, cache, tlb and branch misses of every position; software counters if the PMU is unavailable (use with -bench)", &perfcount, 0, NULL },
+        { "-smpbench", "Lazy SMP scaling benchmark (time to depth, nps and agreement of best move and score with 1 thread) for 1, 2, 4, ..., maxthreads threads with and without marking of nodes in search", &smpbench, 0, NULL },
+        { "-maxthreads", "maximum number of threads (use with -smpbench)", &maxthreads, 1, "32" },
+        { "-clusterbench", "Time to depth of the benchmark positions with a cluster of <n> local processes (use with -depth)", &clusterbench, 1, "0" },
+        { "-clusterworker", "Run as worker of the cluster master listening on host:port", &clusterworker, 2, "" },
+        { "-latencybench", "Measure latency from go to first node with 1, 8 and 64 threads.", &latencybench, 0, NULL },
+        { "-microbench", "Measure the time per call of move generation, make/unmake, see, eval, nnue, tt and tablebase probes over the bench positions or an epd file (-epdfile)", &microbench, 0, NULL },
         { "-depth", "Depth for benchmark (0 for per-position-default)", &depth, 1, "0" },
         { "-perft", "Do performance and move generator testing.", &perfmaxdepth, 1, "0" },
         { "-dotests","test the hash function and value for positions and mirror (use with -perft)", &dotests, 0, NULL },
         { "-enginetest", "bulk testing of epd files", &enginetest, 0, NULL },
-        { "-epdfile", "the epd file to test (use with -enginetest or -bench)", &epdfile, 2, "" },
+        { "-epdfile", "the epd file to test (use with -enginetest, -bench or -smpbench)", &epdfile, 2, "" },
         { "-logfile", "output file (use with -enginetest)", &logfile, 2, "enginetest.log" },
         { "-engineprg", "the uci engine to test (use with -enginetest)", &engineprg, 2, "" },
         { "-maxtime", "time for each test in seconds (use with -enginetest or -bench)", &maxtime, 1, "0" },
+        { "-epdworkers", "solve the positions of the epd file in <n> engine processes in parallel; each uses the Threads and Hash options (use with -bench and -epdfile)", &epdworkers, 1, "0" },
+        { "-epdworker", "worker process for -epdworkers; reads epd lines from stdin", &epdworker, 0, NULL },
         { "-startnum", "number of the test in epd to start with (use with -enginetest or -bench)", &startnum, 1, "1" },
+        { "-concurrency", "number of positions tested in parallel, each by its own engine processes (use with -enginetest)", &concurrency, 1, "1" },
         { "-compare", "for fast comparision against logfile from other engine (use with -enginetest)", &comparefile, 2, "" },
         { "-flags", "1=skip easy (0 sec.) compares; 2=break 5 seconds after first find; 4=break after compare time is over; 8=eval only (use with -enginetest)", &flags, 1, "0" },
         { "-option", "Set UCI option by commandline", NULL, 3, NULL },
+        { "-timeloganalyze", "Summary of a time management log (written with option TimeLogFile)", &timeloganalyze, 2, "" },
+        { "-traceanalyze", "Statistics of the search trees in a trace file (written by a SEARCHTRACE build with SearchTraceFile)", &traceanalyze, 2, "" },
         { "-generate", "Generates epd file with n (default 1000) random endgame positions of the given type; format: egstr/n ", &genepd, 2, "" },
+#ifdef COROUTINES
+        { "-corobench", "Compare nps of regular and interleaved coroutine search with <n> milliseconds per position", &corobench, 1, "0" },
+#endif
 #ifdef STACKDEBUG
         { "-assertfile", "output assert info to file", &en.assertfile, 2, "" },
 #endif
@@ -1027,30 +2574,80 @@ int main(int argc, char* argv[])
     {
         // do a perft test
         perftest(dotests, perfmaxdepth);
-    } else if (benchmark || openbench)
+    }
+#ifndef _WIN32
+    else if (benchmark && epdworkers > 0 && epdfile != "")
+    {
+        doParallelEpdBenchmark(depth, epdfile, maxtime, startnum, epdworkers, argv[0]);
+    }
+    else if (epdworker)
+    {
+        doEpdWorker(depth, maxtime);
+    }
+#endif
+    else if (benchmark || openbench)
     {
         // benchmark mode
-        doBenchmark(depth, epdfile, maxtime, startnum, openbench);
+        vector<list<benchmarkstruct>> runs(max(1, benchruns));
+        for (auto& r : runs)
+            doBenchmark(depth, epdfile, maxtime, startnum, openbench, perfcount, &r);
+        if (benchjson != "")
+            benchWriteJson(benchjson, runs);
+        if (benchcompare != "" && benchCompare(benchcompare, runs))
+            retval = 1;
 #ifdef NNUE
-        if (NnueReady && !openbench && epdfile == "")
+        // the comparison is done with the default evaluation only
+        if (NnueReady && !openbench && epdfile == "" && benchjson == "" && benchcompare == "")
         {
             NnueType nt = NnueReady;
             NnueReady = NnueDisabled;
-            doBenchmark(depth, epdfile, maxtime, startnum, openbench);
+            doBenchmark(depth, epdfile, maxtime, startnum, openbench, perfcount);
             NnueReady = nt;
         }
 #endif
-    } else if (enginetest)
+    } else if (smpbench)
     {
-#ifdef _WIN32
-        //engine test mode
-        testengine(epdfile, startnum, engineprg, logfile, comparefile, maxtime, flags);
+        doSmpBenchmark(depth, maxthreads, epdfile);
+    } else if (latencybench)
+    {
+        doLatencyBenchmark();
+    } else if (microbench)
+    {
+        doMicroBenchmark(epdfile);
+    }
+#ifdef COROUTINES
+    else if (corobench)
+    {
+        doCoroutineBenchmark(corobench);
+    }
+#endif
+#ifndef _WIN32
+    else if (clusterbench)
+    {
+        doClusterBenchmark(depth, clusterbench, argv[0]);
+    }
+    else if (clusterworker != "")
+    {
+        doClusterWorker(clusterworker);
+    }
 #endif
+    else if (enginetest)
+    {
+        //engine test mode
+        testengine(epdfile, startnum, engineprg, logfile, comparefile, maxtime, flags, concurrency);
     }
     else if (genepd != "")
     {
         generateEpd(genepd);
     }
+    else if (traceanalyze != "")
+    {
+        traceAnalyze(traceanalyze);
+    }
+    else if (timeloganalyze != "")
+    {
+        timeLogAnalyze(timeloganalyze);
+    }
 #ifdef EVALTUNE
     else if (pgnfilename != "")
     {
@@ -1067,8 +2664,10 @@ int main(int argc, char* argv[])
         en.communicate("");
     }
 
+    cl.stop();
+
 #ifdef EVALTUNE
     tuneCleanup();
 #endif
-    return 0;
+    return retval;
 }
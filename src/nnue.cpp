@@ -172,6 +172,7 @@ typedef __m128i vec_t;
 
 template <NnueType Nt> void chessposition::RefreshAccumulator()
 {
+    PROFILESCOPE(PROF_NNUEREFRESH);
     NnueAccumulator *ac = &accumulator[mstop];
     NnueIndexList activeIndices[2];
     activeIndices[0].size = activeIndices[1].size = 0;
@@ -230,6 +231,7 @@ template <NnueType Nt> void chessposition::RefreshAccumulator()
 // Test if we can update the accumulator from the previous position
 template <NnueType Nt> bool chessposition::UpdateAccumulator()
 {
+    PROFILESCOPE(PROF_NNUEUPDATE);
     NnueAccumulator* ac = &accumulator[mstop];
     if (ac->computationState)
         return true;
@@ -412,11 +414,14 @@ template <NnueType Nt> int chessposition::NnueGetEval()
     NnueNetwork network;
 
     Transform<Nt>(network.input);
-    NnueHd1->Propagate(network.input, network.hidden1_values);
-    NnueCl1->Propagate(network.hidden1_values, network.hidden1_clipped);
-    NnueHd2->Propagate(network.hidden1_clipped, network.hidden2_values);
-    NnueCl1->Propagate(network.hidden2_values, network.hidden2_clipped);
-    NnueOut->Propagate(network.hidden2_clipped, &network.out_value);
+    {
+        PROFILESCOPE(PROF_NNUEPROPAGATE);
+        NnueHd1->Propagate(network.input, network.hidden1_values);
+        NnueCl1->Propagate(network.hidden1_values, network.hidden1_clipped);
+        NnueHd2->Propagate(network.hidden1_clipped, network.hidden2_values);
+        NnueCl1->Propagate(network.hidden2_values, network.hidden2_clipped);
+        NnueOut->Propagate(network.hidden2_clipped, &network.out_value);
+    }
 
     return network.out_value / NnueValueScale;
 }
@@ -736,6 +741,10 @@ void NnueReadNet(string path)
 // This avoids putting these definitions in header file
 template int chessposition::NnueGetEval<NnueRotate>();
 template int chessposition::NnueGetEval<NnueFlip>();
+template void chessposition::RefreshAccumulator<NnueRotate>();
+template void chessposition::RefreshAccumulator<NnueFlip>();
+template bool chessposition::UpdateAccumulator<NnueRotate>();
+template bool chessposition::UpdateAccumulator<NnueFlip>();
 
 
 #endif
\ No newline at end of file
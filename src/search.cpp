@@ -18,9 +18,9 @@
 
 #include "RubiChess.h"
 
-#ifdef STATISTICS
-statistic statistics;
-#endif
+// nodes of the main thread when it finished an iteration; for the effective branching factor in the statistics.
+// The helper threads don't follow the iterations of the main thread so their nodes are not included.
+static U64 iterationnodes[MAXDEPTH];
 
 #ifdef SEARCHOPTIONS
 void searchtableinit();
@@ -99,6 +99,8 @@ struct searchparamset {
     searchparam SP(aspincratio, 4);
     searchparam SP(aspincbase, 2);
     searchparam SP(aspinitialdelta, 8);
+    // Lazy SMP coordination
+    searchparam SP(smpmarkmindepth, 6);
 } sps;
 
 #define MAXLMPDEPTH 9
@@ -109,6 +111,40 @@ int lmptable[2][MAXLMPDEPTH];
 static const int SkipSize[16] = { 1, 1, 1, 2, 2, 2, 1, 3, 2, 2, 1, 3, 3, 2, 2, 1 };
 static const int SkipDepths[16] = { 1, 2, 2, 4, 4, 3, 2, 5, 4, 3, 2, 6, 5, 4, 3, 2 };
 
+// Simplified ABDADA: Threads mark the nodes they are currently searching in a small lockless table.
+// Other threads search these nodes with more reduction and so spend their time in different subtrees.
+#define SEARCHINGTABLESIZE 4096
+#define SEARCHINGKEY(h, t) (((h) & ~0xffULL) | (uint8_t)(t))
+static atomic<U64> searchingtable[SEARCHINGTABLESIZE];
+
+class searchingmarker
+{
+    atomic<U64> *entry = nullptr;
+    bool owning;
+public:
+    bool otherThread;
+    searchingmarker(U64 hash, int threadindex, bool enabled) {
+        owning = otherThread = false;
+        if (!enabled)
+            return;
+        entry = &searchingtable[hash & (SEARCHINGTABLESIZE - 1)];
+        U64 e = entry->load(memory_order_relaxed);
+        if (!e)
+        {
+            entry->store(SEARCHINGKEY(hash, threadindex), memory_order_relaxed);
+            owning = true;
+        }
+        else
+        {
+            otherThread = ((e ^ hash) < 0x100ULL && e != SEARCHINGKEY(hash, threadindex));
+        }
+    }
+    ~searchingmarker() {
+        if (owning)
+            entry->store(0ULL, memory_order_relaxed);
+    }
+};
+
 
 void searchtableinit()
 {
@@ -216,7 +252,57 @@ inline void chessposition::updateTacticalHst(uint32_t code, int value)
 }
 
 
+#ifdef SEARCHTRACE
+//
+// Tracing build: alphabeta and getQuiescence are wrappers that log every node to the trace buffer of the thread.
+// The search itself is done by the ...Node functions; they tag their pruning exits with TRACEEXIT.
+//
+void chessposition::traceNode(int alpha, int beta, int depth, int score, int flags, U64 nodes)
+{
+    tracerecord r;
+    r.hash = hash;
+    r.alpha = (int16_t)alpha;
+    r.beta = (int16_t)beta;
+    r.score = (int16_t)score;
+    r.depth = (int16_t)depth;
+    r.nodes = (uint32_t)min(nodes, (U64)UINT32_MAX);
+    r.ply = (uint8_t)ply;
+    r.flags = (uint8_t)(flags | (alpha != beta - 1 ? TRACEPVNODE : 0) | (isCheckbb ? TRACECHECK : 0));
+    r.exit = traceexit[ply];
+    r.thread = (uint8_t)threadindex;
+    strace.write(threadindex, &r);
+}
+
+
 int chessposition::getQuiescence(int alpha, int beta, int depth)
+{
+    // alphabeta may have tagged its exit at the same ply already
+    uint8_t lastexit = traceexit[ply];
+    traceexit[ply] = TE_MOVELOOP;
+    int score = getQuiescenceNode(alpha, beta, depth);
+    traceNode(alpha, beta, depth, score, TRACEQS, 0);
+    traceexit[ply] = lastexit;
+    return score;
+}
+
+
+int chessposition::alphabeta(int alpha, int beta, int depth)
+{
+    uint8_t lastexit = traceexit[ply];
+    int flags = (excludemovestack[mstop - 1] ? TRACESINGULAR : 0);
+    U64 startnodes = counters.nodes.load(memory_order_relaxed);
+    traceexit[ply] = TE_MOVELOOP;
+    int score = alphabetaNode(alpha, beta, depth);
+    traceNode(alpha, beta, depth, score, flags, counters.nodes.load(memory_order_relaxed) - startnodes);
+    traceexit[ply] = lastexit;
+    return score;
+}
+
+
+int chessposition::getQuiescenceNode(int alpha, int beta, int depth)
+#else
+int chessposition::getQuiescence(int alpha, int beta, int depth)
+#endif
 {
     int score;
     int bestscore = NOSCORE;
@@ -241,7 +327,7 @@ int chessposition::getQuiescence(int alpha, int beta, int depth)
     //en.nodes++;
 
     // Reset pv
-    pvtable[ply][0] = 0;
+    pvline(ply)[0] = 0;
 
 #ifdef SDEBUG
     chessmove debugMove;
@@ -258,6 +344,7 @@ int chessposition::getQuiescence(int alpha, int beta, int depth)
     if (tpHit)
     {
         STATISTICSINC(qs_tt);
+        TRACEEXIT(TE_TT);
         return hashscore;
     }
 
@@ -281,7 +368,7 @@ int chessposition::getQuiescence(int alpha, int beta, int depth)
         {
             STATISTICSINC(qs_pat);
             tp.addHash(hash, staticeval, staticeval, HASHBETA, 0, 0);
-
+            TRACEEXIT(TE_STANDPAT);
             return staticeval;
         }
         if (staticeval > alpha)
@@ -299,6 +386,7 @@ int chessposition::getQuiescence(int alpha, int beta, int depth)
         {
             STATISTICSINC(qs_delta);
             tp.addHash(hash, bestExpectableScore, staticeval, HASHALPHA, 0, 0);
+            TRACEEXIT(TE_DELTA);
             return staticeval;
         }
     }
@@ -357,8 +445,11 @@ int chessposition::getQuiescence(int alpha, int beta, int depth)
 #endif
 
     if (myIsCheck && !ms.legalmovenum)
+    {
         // It's a mate
+        TRACEEXIT(TE_MATE);
         return SCOREBLACKWINS + ply;
+    }
 
     tp.addHash(hash, alpha, staticeval, eval_type, 0, (uint16_t)bestcode);
     return bestscore;
@@ -366,7 +457,11 @@ int chessposition::getQuiescence(int alpha, int beta, int depth)
 
 
 
+#ifdef SEARCHTRACE
+int chessposition::alphabetaNode(int alpha, int beta, int depth)
+#else
 int chessposition::alphabeta(int alpha, int beta, int depth)
+#endif
 {
     int score;
     int hashscore = NOSCORE;
@@ -380,11 +475,11 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
     int effectiveDepth;
     const bool PVNode = (alpha != beta - 1);
 
-    nodes++;
+    counters.addNode();
     CheckForImmediateStop();
 
     // Reset pv
-    pvtable[ply][0] = 0;
+    pvline(ply)[0] = 0;
 
     STATISTICSINC(ab_n);
     STATISTICSADD(ab_pv, PVNode);
@@ -394,6 +489,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
     if (rep >= 2)
     {
         STATISTICSINC(ab_draw_or_win);
+        TRACEEXIT(TE_DRAW);
         return SCOREDRAW;
     }
 
@@ -401,6 +497,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
     if (halfmovescounter >= 100)
     {
         STATISTICSINC(ab_draw_or_win);
+        TRACEEXIT(TE_DRAW);
         if (!isCheckbb)
         {
             return SCOREDRAW;
@@ -409,14 +506,27 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
             chessmovelist evasions;
             if (CreateEvasionMovelist(this, &evasions.move[0]) > 0)
                 return SCOREDRAW;
-            else
-                return SCOREBLACKWINS + ply;
+            TRACEEXIT(TE_MATE);
+            return SCOREBLACKWINS + ply;
+        }
+    }
+
+    // test for an upcoming repetition; a draw is at least reachable by one move
+    if (alpha < SCOREDRAW && upcomingRepetition())
+    {
+        STATISTICSINC(ab_draw_or_win);
+        alpha = SCOREDRAW;
+        if (alpha >= beta)
+        {
+            TRACEEXIT(TE_DRAW);
+            return alpha;
         }
     }
 
     if (en.stopLevel == ENGINESTOPIMMEDIATELY)
     {
         // time is over; immediate stop requested
+        TRACEEXIT(TE_STOP);
         return beta;
     }
 
@@ -428,12 +538,16 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
             seldepth = ply + 1;
 
         STATISTICSINC(ab_qs);
+        TRACEEXIT(TE_QSEARCH);
         return getQuiescence(alpha, beta, depth);
     }
 
     // Maximum depth
     if (mstop >= MAXDEPTH - MOVESTACKRESERVE)
+    {
+        TRACEEXIT(TE_QSEARCH);
         return getQuiescence(alpha, beta, depth);
+    }
 
 
     // Get move for singularity check and change hash to seperate partial searches from full searches
@@ -460,8 +574,9 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
             if (!PVNode)
             {
                 STATISTICSINC(ab_tt);
+                TRACEEXIT(TE_TT);
                 SDEBUGDO(isDebugPv, pvabortval[ply] = hashscore; if (debugMove.code == fullhashmove) pvaborttype[ply] = PVA_FROMTT; else pvaborttype[ply] =  PVA_DIFFERENTFROMTT; );
-                SDEBUGDO(isDebugPv, pvadditionalinfo[ply] = "PV = " + getPv(pvtable[ply]) + "  " + tp.debugGetPv(newhash); );
+                SDEBUGDO(isDebugPv, pvadditionalinfo[ply] = "PV = " + getPv(pvline(ply)) + "  " + tp.debugGetPv(newhash); );
                 return hashscore;
             }
 
@@ -481,7 +596,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
         int success;
         int v = probe_wdl(&success, this);
         if (success) {
-            en.tbhits++;
+            counters.addTbhit();
             int bound;
             if (v <= -1 - en.Syzygy50MoveRule) {
                 bound = HASHALPHA;
@@ -500,6 +615,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
                 tp.addHash(hash, score, staticeval, bound, MAXDEPTH, 0);
             }
             STATISTICSINC(ab_tb);
+            TRACEEXIT(TE_TB);
             return score;
         }
     }
@@ -535,12 +651,14 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
             {
                 qscore = getQuiescence(alpha, beta, depth);
                 SDEBUGDO(isDebugPv, pvabortval[ply] = qscore; pvaborttype[ply] = PVA_RAZORPRUNED;);
+                TRACEEXIT(TE_RAZOR);
                 return qscore;
             }
             qscore = getQuiescence(ralpha, ralpha + 1, depth);
             if (qscore <= ralpha)
             {
                 SDEBUGDO(isDebugPv, pvabortval[ply] = qscore; pvaborttype[ply] = PVA_RAZORPRUNED;);
+                TRACEEXIT(TE_RAZOR);
                 return qscore;
             }
         }
@@ -555,6 +673,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
         {
             STATISTICSINC(prune_futility);
             SDEBUGDO(isDebugPv, pvabortval[ply] = staticeval; pvaborttype[ply] = PVA_REVFUTILITYPRUNED;);
+            TRACEEXIT(TE_REVFUTILITY);
             return staticeval;
         }
         futility = (staticeval < alpha - (sps.futilitymargin + sps.futilitymarginperdepth * depth));
@@ -575,6 +694,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
             if (abs(beta) < 5000 && (depth < sps.nmverificationdepth || nullmoveply)) {
                 STATISTICSINC(prune_nm);
                 SDEBUGDO(isDebugPv, pvabortval[ply] = score; pvaborttype[ply] = PVA_NMPRUNED;);
+                TRACEEXIT(TE_NULLMOVE);
                 return beta;
             }
             // Verification search
@@ -585,6 +705,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
             if (verificationscore >= beta) {
                 STATISTICSINC(prune_nm);
                 SDEBUGDO(isDebugPv, pvabortval[ply] = score; pvaborttype[ply] = PVA_NMPRUNED;);
+                TRACEEXIT(TE_NULLMOVE);
                 return beta;
             }
         }
@@ -618,6 +739,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
                     delete movelist;
                     STATISTICSINC(prune_probcut);
                     SDEBUGDO(isDebugPv, pvabortval[ply] = probcutscore; pvaborttype[ply] = PVA_PROBCUTPRUNED; pvadditionalinfo[ply] = "pruned by " + movelist->move[i].toString(););
+                    TRACEEXIT(TE_PROBCUT);
                     return probcutscore;
                 }
             }
@@ -717,6 +839,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
                 // Hashscore for lower depth and static eval cut and we have at least a second good move => lets cut here
                 STATISTICSINC(prune_multicut);
                 SDEBUGDO(isDebugPv, pvabortval[ply] = sBeta; pvaborttype[ply] = PVA_MULTICUT;);
+                TRACEEXIT(TE_MULTICUT);
                 return sBeta;
             }
         }
@@ -811,6 +934,15 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
         LegalMoves[ply] = ms.legalmovenum;
         SDEBUGDO(isDebugMove, pvadditionalinfo[ply-1] = ""; );
 
+        // Search late moves with more reduction if another thread is already busy with the child node
+        searchingmarker marker(hash, threadindex, en.smpMarking && en.Threads > 1 && depth >= sps.smpmarkmindepth);
+        if (marker.otherThread && legalMoves > 1)
+        {
+            STATISTICSINC(red_smpmarked);
+            reduction++;
+            effectiveDepth--;
+        }
+
         if (reduction)
         {
             // LMR search; test against alpha
@@ -841,6 +973,7 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
         if (en.stopLevel == ENGINESTOPIMMEDIATELY)
         {
             // time is over; immediate stop requested
+            TRACEEXIT(TE_STOP);
             return beta;
         }
 
@@ -878,6 +1011,8 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
                 }
 
                 STATISTICSINC(moves_fail_high);
+                STATISTICSADD(moves_fail_high_first, legalMoves == 1);
+                STATISTICSINC(ab_type[HASHBETA]);
 
                 if (!excludeMove)
                     tp.addHash(newhash, FIXMATESCOREADD(score, ply), staticeval, HASHBETA, effectiveDepth, (uint16_t)bestcode);
@@ -910,14 +1045,18 @@ int chessposition::alphabeta(int alpha, int beta, int depth)
         STATISTICSINC(ab_draw_or_win);
         if (isCheckbb) {
             // It's a mate
+            TRACEEXIT(TE_MATE);
             return SCOREBLACKWINS + ply;
         }
         else {
             // It's a stalemate
+            TRACEEXIT(TE_DRAW);
             return SCOREDRAW;
         }
     }
 
+    STATISTICSINC(ab_type[eval_type]);
+
     if (bestcode && !excludeMove)
     {
         tp.addHash(newhash, FIXMATESCOREADD(bestscore, ply), staticeval, eval_type, depth, (uint16_t)bestcode);
@@ -943,11 +1082,11 @@ int chessposition::rootsearch(int alpha, int beta, int depth, int inWindowLast)
 
     const bool isMultiPV = (RT == MultiPVSearch);
 
-    nodes++;
+    counters.addNode();
     CheckForImmediateStop();
 
     // reset pv
-    pvtable[0][0] = 0;
+    pvline(0)[0] = 0;
 
     if (isMultiPV)
     {
@@ -984,7 +1123,7 @@ int chessposition::rootsearch(int alpha, int beta, int depth, int inWindowLast)
             if (score > NOSCORE)
             {
                 SDEBUGDO(isDebugPv, pvabortval[ply] = score; if (debugMove.code == fullhashmove) pvaborttype[ply] = PVA_FROMTT; else pvaborttype[ply] = PVA_DIFFERENTFROMTT; );
-                SDEBUGDO(isDebugPv, pvadditionalinfo[ply] = "PV = " + getPv(pvtable[ply]) + "  " + tp.debugGetPv(hash); );
+                SDEBUGDO(isDebugPv, pvadditionalinfo[ply] = "PV = " + getPv(pvline(ply)) + "  " + tp.debugGetPv(hash); );
                 return score;
             }
         }
@@ -1114,7 +1253,7 @@ int chessposition::rootsearch(int alpha, int beta, int depth, int inWindowLast)
                 while (newindex > 0 && score > bestmovescore[newindex - 1])
                 {
                     bestmovescore[newindex] = bestmovescore[newindex - 1];
-                    uint32_t *srctable = (newindex - 1 ? multipvtable[newindex - 1] : pvtable[0]);
+                    uint32_t *srctable = (newindex - 1 ? multipvtable[newindex - 1] : pvline(0));
                     memcpy(multipvtable[newindex], srctable, sizeof(multipvtable[newindex]));
                     newindex--;
                 }
@@ -1143,14 +1282,14 @@ int chessposition::rootsearch(int alpha, int beta, int depth, int inWindowLast)
             {
                 SDEBUGDO(isDebugPv, pvaborttype[0] = isDebugMove ? PVA_BESTMOVE : debugMovePlayed ? PVA_NOTBESTMOVE : PVA_OMITTED;);
                 updatePvTable(m->code, true);
-                if (bestmove.code != pvtable[0][0])
+                if (bestmove.code != pvline(0)[0])
                 {
-                    bestmove.code = pvtable[0][0];
-                    pondermove.code = pvtable[0][1];
+                    bestmove.code = pvline(0)[0];
+                    pondermove.code = pvline(0)[1];
                 }
-                else if (pvtable[0][1]) {
+                else if (pvline(0)[1]) {
                     // use new ponder move
-                    pondermove.code = pvtable[0][1];
+                    pondermove.code = pvline(0)[1];
                 }
                 alpha = score;
                 bestmovescore[0] = score;
@@ -1226,14 +1365,14 @@ static void uciScore(searchthread *thr, int inWindow, U64 nowtime, int score, in
     {
         sprintf_s(s, "info depth %d seldepth %d multipv %d time %d score cp %d %snodes %llu nps %llu tbhits %llu hashfull %d pv %s\n",
             thr->depth, pos->seldepth, mpvIndex + 1, msRun, score, boundscore[inWindow], nodes, nps,
-            en.tbhits, tp.getUsedinPermill(), pvstring.c_str());
+            en.getTotalTbhits(), tp.getUsedinPermill(), pvstring.c_str());
     }
     else
     {
         int matein = (score > 0 ? (SCOREWHITEWINS - score + 1) / 2 : (SCOREBLACKWINS - score) / 2);
         sprintf_s(s, "info depth %d seldepth %d multipv %d time %d score mate %d %snodes %llu nps %llu tbhits %llu hashfull %d pv %s\n",
             thr->depth, pos->seldepth, mpvIndex + 1, msRun, matein, boundscore[inWindow], nodes, nps,
-            en.tbhits, tp.getUsedinPermill(), pvstring.c_str());
+            en.getTotalTbhits(), tp.getUsedinPermill(), pvstring.c_str());
     }
     cout << s;
 #ifdef SDEBUG
@@ -1242,6 +1381,136 @@ static void uciScore(searchthread *thr, int inWindow, U64 nowtime, int score, in
 }
 
 
+//
+// Time management telemetry
+// With option TimeLogFile the main thread appends a line per search with the planned and used time, the reason
+// of the stop and the lag between stop and output of bestmove. Use -timeloganalyze <file> for a summary.
+//
+
+static const char *timestopname[TSR_NUM] = { "soft", "hard", "single", "depth", "nodes", "stop" };
+
+bool timeLogOpen(string filename)
+{
+    en.timelog = fopen(filename.c_str(), "a");
+    if (!en.timelog)
+        return false;
+    fseek(en.timelog, 0, SEEK_END);
+    if (ftell(en.timelog) == 0)
+        fprintf(en.timelog, "move time inc movestogo threads overhead ponderhit soft hard softfinal hardfinal used lag depth stop\n");
+    fflush(en.timelog);
+    return true;
+}
+
+
+// milliseconds since start of the search; -1 for no time limit
+static long long timeLogMs(U64 t)
+{
+    return t ? (long long)(t - en.starttime) * 1000 / (long long)en.frequency : -1;
+}
+
+
+static void timeLogMove(searchthread *thr, int stopreason, U64 stoptime)
+{
+    U64 bestmovetime = getTime();
+    chessposition *pos = &thr->pos;
+    fprintf(en.timelog, "%d %d %d %d %d %d %d %lld %lld %lld %lld %.2f %.2f %d %s\n",
+        pos->fullmovescounter, en.isWhite ? en.wtime : en.btime, en.isWhite ? en.winc : en.binc, en.movestogo, en.Threads,
+        en.moveOverhead, en.ponderhit, timeLogMs(en.plannedendtime1), timeLogMs(en.plannedendtime2), timeLogMs(en.endtime1), timeLogMs(en.endtime2),
+        (bestmovetime - en.starttime) * 1000.0 / en.frequency, (bestmovetime - stoptime) * 1000.0 / en.frequency, thr->depth - 1, timestopname[stopreason]);
+    fflush(en.timelog);
+}
+
+
+static void timeLogPercentiles(const char *name, vector<double> &v)
+{
+    if (!v.size())
+        return;
+    sort(v.begin(), v.end());
+    size_t n = v.size();
+    double sum = 0.0;
+    for (double d : v)
+        sum += d;
+    printf("%-28s %8.2f %8.2f %8.2f %8.2f %8.2f\n", name, v[n / 2], v[min(n - 1, n * 9 / 10)], v[min(n - 1, n * 99 / 100)], v[n - 1], sum / n);
+}
+
+
+static void timeLogHistogram(const char *name, vector<double> &v)
+{
+    const double limit[] = { 0, 1, 2, 5, 10, 20, 50 };
+    int count[8] = { 0 };
+    for (double ms : v)
+    {
+        int i = 0;
+        while (i < 7 && ms > limit[i])
+            i++;
+        count[i]++;
+    }
+    printf("%-28s in time %d  <1ms %d  <2ms %d  <5ms %d  <10ms %d  <20ms %d  <50ms %d  more %d\n",
+        name, count[0], count[1], count[2], count[3], count[4], count[5], count[6], count[7]);
+}
+
+
+void timeLogAnalyze(string filename)
+{
+    ifstream is(filename);
+    if (!is.is_open())
+    {
+        printf("Cannot open time log file %s\n", filename.c_str());
+        return;
+    }
+
+    int moves = 0;
+    int timedmoves = 0;
+    int forfeits = 0;
+    int stops[TSR_NUM] = { 0 };
+    vector<double> usedsoft, usedhard, lag, overshoot;
+    string line;
+    while (getline(is, line))
+    {
+        istringstream ss(line);
+        int move, time, inc, movestogo, threads, overhead, ponderhit, depth;
+        long long soft, hard, softfinal, hardfinal;
+        double used, lagms;
+        string reason;
+        if (!(ss >> move >> time >> inc >> movestogo >> threads >> overhead >> ponderhit >> soft >> hard >> softfinal >> hardfinal >> used >> lagms >> depth >> reason))
+            continue;
+        moves++;
+        for (int i = 0; i < TSR_NUM; i++)
+            if (reason == timestopname[i])
+                stops[i]++;
+        lag.push_back(lagms);
+        if (hard < 0)
+            continue;
+        timedmoves++;
+        if (soft > 0)
+            usedsoft.push_back(used / soft);
+        if (hard > 0)
+            usedhard.push_back(used / hard);
+        overshoot.push_back(max(0.0, used - hardfinal));
+        if (time && used > time)
+            forfeits++;
+    }
+
+    printf("Time log:    %s\n", filename.c_str());
+    printf("Moves:       %d  (%d with time limit)\n", moves, timedmoves);
+    if (!moves)
+        return;
+    printf("Stopped by: ");
+    for (int i = 0; i < TSR_NUM; i++)
+        printf("  %s %d (%.1f%%)", timestopname[i], stops[i], 100.0 * stops[i] / moves);
+    printf("\n\n%-28s %8s %8s %8s %8s %8s\n", "", "median", "90%", "99%", "max", "mean");
+    timeLogPercentiles("used / planned soft time", usedsoft);
+    timeLogPercentiles("used / planned hard time", usedhard);
+    timeLogPercentiles("lag stop -> bestmove (ms)", lag);
+    timeLogPercentiles("overshoot of hard time (ms)", overshoot);
+    printf("\n");
+    timeLogHistogram("lag stop -> bestmove:", lag);
+    timeLogHistogram("overshoot of hard time:", overshoot);
+    if (forfeits)
+        printf("\nMoves that used more than the remaining time: %d\n", forfeits);
+}
+
+
 template <RootsearchType RT>
 static void search_gen1(searchthread *thr)
 {
@@ -1259,6 +1528,8 @@ static void search_gen1(searchthread *thr)
     const bool isMultiPV = (RT == MultiPVSearch);
     const bool isMainThread = (thr->index == 0);
 
+    thr->firstnodetime = getTime();
+
     chessposition *pos = &thr->pos;
 
     if (en.mate > 0)  // FIXME: Not tested for a long time.
@@ -1283,6 +1554,8 @@ static void search_gen1(searchthread *thr)
     int lastiterationscore = NOSCORE;
     en.lastReport = 0;
     U64 nowtime;
+    int stopreason = TSR_STOP;
+    U64 stoptime = 0;
     pos->lastpv[0] = 0;
     bool isDraw = (pos->testRepetiton() >= 2) || (pos->halfmovescounter >= 100);
     do
@@ -1340,6 +1613,8 @@ static void search_gen1(searchthread *thr)
             {
                 inWindow = 1;
                 thr->lastCompleteDepth = thr->depth;
+                if (isMainThread && en.SearchStatistics)
+                    iterationnodes[thr->depth] = pos->counters.nodes;
                 if (score >= en.terminationscore)
                 {
                     // bench mode reached needed score
@@ -1360,10 +1635,10 @@ static void search_gen1(searchthread *thr)
         // copy new pv to lastpv; preserve identical and longer lastpv
         int i = 0;
         int bDiffers = false;
-        while (pos->pvtable[0][i])
+        while (pos->pvline(0)[i])
         {
-            bDiffers = bDiffers || (pos->lastpv[i] != pos->pvtable[0][i]);
-            pos->lastpv[i] = pos->pvtable[0][i];
+            bDiffers = bDiffers || (pos->lastpv[i] != pos->pvline(0)[i]);
+            pos->lastpv[i] = pos->pvline(0)[i];
             i++;
             if (i == MAXDEPTH - 1) break;
         }
@@ -1441,6 +1716,10 @@ static void search_gen1(searchthread *thr)
             }
             lastiterationscore = pos->bestmovescore[0];
 
+            // Cluster worker reports the finished iteration to the master
+            if (cl.rank && cl.enabled && isMainThread && !isMultiPV)
+                cl.sendResult(thr->depth, pos->bestmovescore[0], pos->lastpv);
+
             // Skip some depths depending on current depth and thread number using Laser's method
             int cycle = thr->index % 16;
             if (thr->index && (thr->depth + cycle) % SkipDepths[cycle] == 0)
@@ -1468,7 +1747,17 @@ static void search_gen1(searchthread *thr)
 
         // exit if STOPIMMEDIATELY
         if (en.stopLevel == ENGINESTOPIMMEDIATELY)
+        {
+            stoptime = en.timerstoptime;
+            if (stoptime)
+                stopreason = TSR_HARD;
+            else
+            {
+                stopreason = (en.maxnodes && en.maxnodes <= en.getTotalNodes() ? TSR_NODES : TSR_STOP);
+                stoptime = getTime();
+            }
             break;
+        }
 
         // Pondering; just continue next iteration
         if (en.pondersearch == PONDERING)
@@ -1476,15 +1765,25 @@ static void search_gen1(searchthread *thr)
 
         // early exit in playing mode as there is exactly one possible move
         if (pos->rootmovelist.length == 1 && en.endtime1 && !pos->useRootmoveScore)
+        {
+            stopreason = TSR_SINGLEMOVE;
             break;
+        }
 
         // exit if STOPSOON is requested and we're in aspiration window
         if (en.endtime1 && nowtime >= en.endtime1 && inWindow == 1 && constantRootMoves && isMainThread)
+        {
+            stopreason = TSR_SOFT;
+            stoptime = nowtime;
             break;
+        }
 
         // exit if max depth is reached
         if (thr->depth > maxdepth)
+        {
+            stopreason = TSR_DEPTH;
             break;
+        }
 
     } while (1);
     
@@ -1509,7 +1808,24 @@ static void search_gen1(searchthread *thr)
                 bestthr = hthr;
             }
         }
-        if (pos->bestmove.code != bestthr->pos.bestmove.code)
+        clusterresult clres;
+        bool clusterIsBest = (!cl.rank && cl.enabled && cl.getBestResult(bestthr->lastCompleteDepth, bestscore, &clres));
+        if (clusterIsBest)
+        {
+            // a worker of the cluster finished the same or a deeper iteration with a better score
+            int i = 0;
+            while (clres.pv[i] && i < MAXDEPTH - 1)
+            {
+                pos->lastpv[i] = clres.pv[i];
+                i++;
+            }
+            pos->lastpv[i] = 0;
+            pos->bestmove.code = clres.pv[0];
+            pos->pondermove.code = clres.pv[1];
+            pos->bestmovescore[0] = clres.score;
+            inWindow = 1;
+        }
+        else if (pos->bestmove.code != bestthr->pos.bestmove.code)
         {
             // copy best moves and score from best thread to thread 0
             int i = 0;
@@ -1529,7 +1845,7 @@ static void search_gen1(searchthread *thr)
         // remember score for next search in case of an instamove
         en.rootposition.lastbestmovescore = pos->bestmovescore[0];
 
-        if (!reportedThisDepth || bestthr->index)
+        if (!reportedThisDepth || bestthr->index || clusterIsBest)
             uciScore(thr, inWindow, getTime(), inWindow == 1 ? pos->bestmovescore[0] : score);
 
         string strBestmove;
@@ -1560,6 +1876,24 @@ static void search_gen1(searchthread *thr)
             strPonder = " ponder " + pos->pondermove.toString();
 
         cout << "bestmove " + strBestmove + strPonder + "\n";
+        cl.sendCommand("stop");
+        if (en.timelog)
+            timeLogMove(thr, stopreason, stoptime ? stoptime : nowtime);
+#ifdef TDEBUG
+        if (en.endtime2)
+        {
+            // histogram of the overshoot of endtime2 to calibrate Move Overhead
+            const int overshootlimit[] = { 0, 1, 2, 5, 10, 20, 50 };
+            U64 bestmovetime = getTime();
+            int ms = (bestmovetime > en.endtime2 ? (int)((bestmovetime - en.endtime2) * 1000 / en.frequency) + 1 : 0);
+            int i = 0;
+            while (i < 7 && ms > overshootlimit[i])
+                i++;
+            en.overshoot[i]++;
+            printf("info string stop overshoot: in time %d  <1ms %d  <2ms %d  <5ms %d  <10ms %d  <20ms %d  <50ms %d  more %d\n",
+                en.overshoot[0], en.overshoot[1], en.overshoot[2], en.overshoot[3], en.overshoot[4], en.overshoot[5], en.overshoot[6], en.overshoot[7]);
+        }
+#endif
 
         en.stopLevel = ENGINESTOPIMMEDIATELY;
         en.benchmove = strBestmove;
@@ -1567,9 +1901,8 @@ static void search_gen1(searchthread *thr)
         // Remember depth for benchmark output
         en.benchdepth = thr->depth - 1;
 
-#ifdef STATISTICS
-        search_statistics();
-#endif
+        if (en.SearchStatistics)
+            search_statistics();
     }
 }
 
@@ -1632,6 +1965,7 @@ void resetEndTime(int constantRootMoves, bool complete)
 #ifdef TDEBUG
     printf("info string Time for this move: %4.3f  /  %4.3f\n", (en.endtime1 - en.starttime) / (double)en.frequency, (en.endtime2 - en.starttime) / (double)en.frequency);
 #endif
+    wakeTimer();
 }
 
 
@@ -1639,25 +1973,142 @@ void startSearchTime(bool complete = true)
 {
     en.starttime = getTime();
     resetEndTime(0, complete);
+    en.plannedendtime1 = en.endtime1;
+    en.plannedendtime2 = en.endtime2;
+}
+
+
+// The search threads are created once per allocThreads and wait for the next search
+static void searchThreadLoop(searchthread *thr, int generation)
+{
+    while (true)
+    {
+        unique_lock<mutex> lock(en.poolmutex);
+        en.poolstart.wait(lock, [&]() { return en.poolexit || en.poolgeneration != generation; });
+        if (en.poolexit)
+        {
+#ifdef PROFILING
+            profileUnregisterThread();
+#endif
+            return;
+        }
+        generation = en.poolgeneration;
+        lock.unlock();
+
+        if (en.MultiPV == 1)
+            search_gen1<SinglePVSearch>(thr);
+        else
+            search_gen1<MultiPVSearch>(thr);
+
+        lock.lock();
+        if (--en.poolsearching == 0)
+            en.poolidle.notify_all();
+    }
+}
+
+
+// The timer thread raises the stop flag at endtime2 so the search doesn't need to poll the clock
+static void timerThreadLoop()
+{
+    unique_lock<mutex> lock(en.timermutex);
+    while (!en.timerexit)
+    {
+        U64 endtime = en.endtime2;
+        if (!endtime || en.stopLevel >= ENGINESTOPIMMEDIATELY || en.pondersearch != NO)
+        {
+            // nothing to do until the next timed search or ponderhit
+            en.timerwake.wait(lock);
+            continue;
+        }
+        U64 nowtime = getTime();
+        if (nowtime < endtime)
+        {
+            // endtime2 may change while waiting so check again after wakeup
+            en.timerwake.wait_for(lock, chrono::microseconds((endtime - nowtime) * 1000000 / en.frequency + 1));
+            continue;
+        }
+        if (en.stopLevel < ENGINESTOPIMMEDIATELY)
+        {
+            en.timerstoptime = nowtime;
+            en.stopLevel = ENGINESTOPIMMEDIATELY;
+        }
+    }
+}
+
+
+// Tell the timer thread that endtime2 or the state of the search has changed
+void wakeTimer()
+{
+    {
+        // the lock makes sure that the timer is either waiting or will see the new state
+        lock_guard<mutex> lock(en.timermutex);
+    }
+    en.timerwake.notify_one();
+}
+
+
+void createSearchThreads()
+{
+    en.poolexit = false;
+    for (int tnum = 0; tnum < en.Threads; tnum++)
+        en.sthread[tnum].thr = thread(&searchThreadLoop, &en.sthread[tnum], en.poolgeneration);
+    en.timerexit = false;
+    en.timerthr = thread(&timerThreadLoop);
+}
+
+
+void removeSearchThreads()
+{
+    {
+        lock_guard<mutex> lock(en.poolmutex);
+        en.poolexit = true;
+    }
+    en.poolstart.notify_all();
+    for (int tnum = 0; tnum < en.oldThreads; tnum++)
+        if (en.sthread[tnum].thr.joinable())
+            en.sthread[tnum].thr.join();
+    {
+        lock_guard<mutex> lock(en.timermutex);
+        en.timerexit = true;
+    }
+    en.timerwake.notify_one();
+    if (en.timerthr.joinable())
+        en.timerthr.join();
 }
 
 
 void searchStart()
 {
+    en.timerstoptime = 0;
     startSearchTime();
 
     en.moveoutput = false;
-    en.tbhits = en.sthread[0].pos.tbPosition;  // Rootpos in TB => report at least one tbhit
+    for (int i = 0; i < en.Threads; i++)
+    {
+        en.sthread[i].pos.counters.tbhits = 0;
+        if (en.SearchStatistics)
+            memset((void*)&en.sthread[i].pos.statistics, 0, sizeof(statistic));
+    }
+    if (en.SearchStatistics)
+        memset(iterationnodes, 0, sizeof(iterationnodes));
+    en.sthread[0].pos.counters.tbhits = en.sthread[0].pos.tbPosition;  // Rootpos in TB => report at least one tbhit
 
     // increment generation counter for tt aging
     tp.nextSearch();
 
-    if (en.MultiPV == 1)
-        for (int tnum = 0; tnum < en.Threads; tnum++)
-            en.sthread[tnum].thr = thread(&search_gen1<SinglePVSearch>, &en.sthread[tnum]);
-    else
-        for (int tnum = 0; tnum < en.Threads; tnum++)
-            en.sthread[tnum].thr = thread(&search_gen1<MultiPVSearch>, &en.sthread[tnum]);
+#ifdef SEARCHTRACE
+    strace.newSearch(en.Threads, en.sthread[0].pos.hash);
+#endif
+
+    // cluster workers search until the master stops them
+    cl.sendCommand("go infinite");
+
+    {
+        lock_guard<mutex> lock(en.poolmutex);
+        en.poolsearching = en.Threads;
+        en.poolgeneration++;
+    }
+    en.poolstart.notify_all();
 }
 
 
@@ -1669,18 +2120,20 @@ void searchWaitStop(bool forceStop)
     // Make the other threads stop now
     if (forceStop)
         en.stopLevel = ENGINESTOPIMMEDIATELY;
-    for (int tnum = 0; tnum < en.Threads; tnum++)
-        if (en.sthread[tnum].thr.joinable())
-            en.sthread[tnum].thr.join();
+    unique_lock<mutex> lock(en.poolmutex);
+    en.poolidle.wait(lock, []() { return en.poolsearching == 0; });
+    // the timer shouldn't see the old endtime when the next search starts
+    en.endtime1 = en.endtime2 = 0;
     en.stopLevel = ENGINETERMINATEDSEARCH;
 }
 
 
 inline void chessposition::CheckForImmediateStop()
 {
-    if (threadindex || (nodes & NODESPERCHECK))
+    if (threadindex || (counters.nodes.load(memory_order_relaxed) & NODESPERCHECK))
         return;
 
+    // The time limit is watched by the timer thread
     if (en.pondersearch == PONDERING)
         // pondering... just continue searching
         return;
@@ -1690,14 +2143,7 @@ inline void chessposition::CheckForImmediateStop()
         // ponderhit
         startSearchTime(false);
         en.pondersearch = NO;
-        return;
-    }
-
-    U64 nowtime = getTime();
-
-    if (en.endtime2 && nowtime >= en.endtime2 && en.stopLevel < ENGINESTOPIMMEDIATELY)
-    {
-        en.stopLevel = ENGINESTOPIMMEDIATELY;
+        wakeTimer();
         return;
     }
 
@@ -1710,13 +2156,23 @@ inline void chessposition::CheckForImmediateStop()
 
 
 
-#ifdef STATISTICS
 void search_statistics()
 {
     U64 n, i1, i2, i3;
     double f0, f1, f2, f3, f4, f5, f6, f7, f10, f11;
 
-    printf("(ST)====Statistics====================================================================================================================================\n");
+    // sum up the statistics of all threads
+    statistic statistics;
+    memset((void*)&statistics, 0, sizeof(statistic));
+    for (int t = 0; t < en.Threads; t++)
+    {
+        U64 *src = (U64*)&en.sthread[t].pos.statistics;
+        U64 *dst = (U64*)&statistics;
+        for (size_t i = 0; i < sizeof(statistic) / sizeof(U64); i++)
+            dst[i] += src[i];
+    }
+
+    printf("info string (ST)====Statistics====================================================================================================================================\n");
 
     // quiescense search statistics
     i1 = statistics.qs_n[0];
@@ -1730,7 +2186,7 @@ void search_statistics()
     f4 =  i3 / (double)statistics.qs_loop_n;
     f5 = 100.0 * statistics.qs_move_delta / (double)i3;
     f6 = 100.0 * statistics.qs_moves_fh / (double)statistics.qs_moves;
-    printf("(ST) QSearch: %12lld   %%InCheck:  %5.2f   %%TT-Hits:  %5.2f   %%Std.Pat: %5.2f   %%DeltaPr: %5.2f   Mvs/Lp: %5.2f   %%DlPrM: %5.2f   %%FailHi: %5.2f\n", n, f0, f1, f2, f3, f4, f5, f6);
+    printf("info string (ST) QSearch: %12lld   %%InCheck:  %5.2f   %%TT-Hits:  %5.2f   %%Std.Pat: %5.2f   %%DeltaPr: %5.2f   Mvs/Lp: %5.2f   %%DlPrM: %5.2f   %%FailHi: %5.2f\n", n, f0, f1, f2, f3, f4, f5, f6);
 
     // general aplhabeta statistics
     n = statistics.ab_n;
@@ -1739,7 +2195,15 @@ void search_statistics()
     f2 = 100.0 * statistics.ab_tb / (double)n;
     f3 = 100.0 * statistics.ab_qs / (double)n;
     f4 = 100.0 * statistics.ab_draw_or_win / (double)n;
-    printf("(ST) Total AB:%12lld   %%PV-Nodes: %5.2f   %%TT-Hits:  %5.2f   %%TB-Hits: %5.2f   %%QSCalls: %5.2f   %%Draw/Mates: %5.2f\n", n, f0, f1, f2, f3, f4);
+    printf("info string (ST) Total AB:%12lld   %%PV-Nodes: %5.2f   %%TT-Hits:  %5.2f   %%TB-Hits: %5.2f   %%QSCalls: %5.2f   %%Draw/Mates: %5.2f\n", n, f0, f1, f2, f3, f4);
+
+    // node types of the nodes that finished the moves loop
+    i1 = statistics.ab_type[HASHEXACT] + statistics.ab_type[HASHALPHA] + statistics.ab_type[HASHBETA];
+    f0 = 100.0 * statistics.ab_type[HASHEXACT] / (double)i1;
+    f1 = 100.0 * statistics.ab_type[HASHALPHA] / (double)i1;
+    f2 = 100.0 * statistics.ab_type[HASHBETA] / (double)i1;
+    f3 = 100.0 * statistics.moves_fail_high_first / (double)statistics.moves_fail_high;
+    printf("info string (ST) Node types:%10lld   %%PV:       %5.2f   %%All:      %5.2f   %%Cut:     %5.2f   %%CutByFirstMove: %5.2f\n", i1, f0, f1, f2, f3);
 
     // node pruning
     f0 = 100.0 * statistics.prune_futility / (double)n;
@@ -1747,7 +2211,7 @@ void search_statistics()
     f2 = 100.0 * statistics.prune_probcut / (double)n;
     f3 = 100.0 * statistics.prune_multicut / (double)n;
     f4 = 100.0 * (statistics.prune_futility + statistics.prune_nm + statistics.prune_probcut + statistics.prune_multicut) / (double)n;
-    printf("(ST) Node pruning            %%Futility: %5.2f   %%NullMove: %5.2f   %%ProbeC.: %5.2f   %%MultiC.: %7.5f Total:  %5.2f\n", f0, f1, f2, f3, f4);
+    printf("info string (ST) Node pruning            %%Futility: %5.2f   %%NullMove: %5.2f   %%ProbeC.: %5.2f   %%MultiC.: %7.5f Total:  %5.2f\n", f0, f1, f2, f3, f4);
 
     // move statistics
     i1 = statistics.moves_n[0]; // quiet moves
@@ -1762,7 +2226,7 @@ void search_statistics()
     i3 = statistics.moves_played[0] + statistics.moves_played[1];
     f6 = 100.0 * statistics.moves_fail_high / (double)i3;
     f7 = 100.0 * statistics.moves_bad_hash / i2;
-    printf("(ST) Moves:   %12lld   %%Quiet-M.: %5.2f   %%Tact.-M.: %5.2f   %%BadHshM: %5.2f   %%LMP-M.:  %5.2f   %%FutilM.: %5.2f   %%BadSEE: %5.2f  Mvs/Lp: %5.2f   %%FailHi: %5.2f\n", n, f0, f1, f7, f2, f3, f4, f5, f6);
+    printf("info string (ST) Moves:   %12lld   %%Quiet-M.: %5.2f   %%Tact.-M.: %5.2f   %%BadHshM: %5.2f   %%LMP-M.:  %5.2f   %%FutilM.: %5.2f   %%BadSEE: %5.2f  Mvs/Lp: %5.2f   %%FailHi: %5.2f\n", n, f0, f1, f7, f2, f3, f4, f5, f6);
 
     // late move reduction statistics
     U64 red_n = statistics.red_pi[0] + statistics.red_pi[1];
@@ -1773,12 +2237,424 @@ void search_statistics()
     f3 = statistics.red_pv / (double)red_n;
     f4 = statistics.red_correction / (double)red_n;
     f5 = statistics.red_total / (double)red_n;
-    printf("(ST) Reduct.  %12lld   lmr[0]: %4.2f   lmr[1]: %4.2f   lmr: %4.2f   hist: %4.2f   pv: %4.2f   corr: %4.2f   total: %4.2f\n", red_n, f10, f11, f1, f2, f3, f4, f5);
+    f6 = statistics.red_smpmarked / (double)red_n;
+    printf("info string (ST) Reduct.  %12lld   lmr[0]: %4.2f   lmr[1]: %4.2f   lmr: %4.2f   hist: %4.2f   pv: %4.2f   corr: %4.2f   smp: %4.2f   total: %4.2f\n", red_n, f10, f11, f1, f2, f3, f4, f6, f5);
 
     f0 = 100.0 * statistics.extend_singular / (double)n;
     f1 = 100.0 * statistics.extend_endgame / (double)n;
     f2 = 100.0 * statistics.extend_history / (double)n;
-    printf("(ST) Extensions: %%singular: %7.4f   %%endgame: %7.4f   %%history: %7.4f\n", f0, f1, f2);
-    printf("(ST)==================================================================================================================================================\n");
+    printf("info string (ST) Extensions: %%singular: %7.4f   %%endgame: %7.4f   %%history: %7.4f\n", f0, f1, f2);
+
+    // effective branching factor of the completed iterations
+    string ebf;
+    int lastdepth = 0;
+    for (int d = 1; d < MAXDEPTH; d++)
+    {
+        if (!iterationnodes[d])
+            continue;
+        if (lastdepth)
+        {
+            if (ebf != "")
+                ebf += ", ";
+            ebf += to_string(d) + ":" + to_string(iterationnodes[d] / (double)iterationnodes[lastdepth]).substr(0, 4);
+        }
+        lastdepth = d;
+    }
+    printf("info string (ST) EBF:  %s\n", ebf.c_str());
+    printf("info string (ST)==================================================================================================================================================\n");
+
+    // all counters and the iterations in one line of JSON for further processing
+    stringstream json;
+    json << "{\"threads\":" << en.Threads << ",\"nodes\":" << en.getTotalNodes()
+        << ",\"qs\":{\"n\":[" << statistics.qs_n[0] << "," << statistics.qs_n[1] << "],\"tt\":" << statistics.qs_tt
+        << ",\"pat\":" << statistics.qs_pat << ",\"delta\":" << statistics.qs_delta << ",\"loop\":" << statistics.qs_loop_n
+        << ",\"move_delta\":" << statistics.qs_move_delta << ",\"moves\":" << statistics.qs_moves << ",\"fail_high\":" << statistics.qs_moves_fh << "}"
+        << ",\"ab\":{\"n\":" << statistics.ab_n << ",\"pv\":" << statistics.ab_pv << ",\"tt\":" << statistics.ab_tt
+        << ",\"draw_or_win\":" << statistics.ab_draw_or_win << ",\"qs\":" << statistics.ab_qs << ",\"tb\":" << statistics.ab_tb
+        << ",\"type_pv\":" << statistics.ab_type[HASHEXACT] << ",\"type_all\":" << statistics.ab_type[HASHALPHA] << ",\"type_cut\":" << statistics.ab_type[HASHBETA] << "}"
+        << ",\"prune\":{\"futility\":" << statistics.prune_futility << ",\"nullmove\":" << statistics.prune_nm
+        << ",\"probcut\":" << statistics.prune_probcut << ",\"multicut\":" << statistics.prune_multicut << "}"
+        << ",\"moves\":{\"loop\":" << statistics.moves_loop_n << ",\"n\":[" << statistics.moves_n[0] << "," << statistics.moves_n[1] << "]"
+        << ",\"lmp\":" << statistics.moves_pruned_lmp << ",\"futility\":" << statistics.moves_pruned_futility << ",\"badsee\":" << statistics.moves_pruned_badsee
+        << ",\"played\":[" << statistics.moves_played[0] << "," << statistics.moves_played[1] << "],\"fail_high\":" << statistics.moves_fail_high
+        << ",\"fail_high_first\":" << statistics.moves_fail_high_first << ",\"bad_hash\":" << statistics.moves_bad_hash << "}"
+        << ",\"reduction\":{\"total\":" << statistics.red_total << ",\"lmr\":[" << statistics.red_lmr[0] << "," << statistics.red_lmr[1] << "]"
+        << ",\"reduced\":[" << statistics.red_pi[0] << "," << statistics.red_pi[1] << "],\"history\":" << statistics.red_history
+        << ",\"pv\":" << statistics.red_pv << ",\"correction\":" << statistics.red_correction << ",\"smpmarked\":" << statistics.red_smpmarked << "}"
+        << ",\"extension\":{\"singular\":" << statistics.extend_singular << ",\"endgame\":" << statistics.extend_endgame << ",\"history\":" << statistics.extend_history << "}"
+        << ",\"iterations\":[";
+    lastdepth = 0;
+    for (int d = 1; d < MAXDEPTH; d++)
+    {
+        if (!iterationnodes[d])
+            continue;
+        json << (lastdepth ? "," : "") << "{\"depth\":" << d << ",\"nodes\":" << iterationnodes[d];
+        if (lastdepth)
+            json << ",\"ebf\":" << fixed << setprecision(3) << iterationnodes[d] / (double)iterationnodes[lastdepth];
+        json << "}";
+        lastdepth = d;
+    }
+    json << "]}";
+    printf("info string statistics %s\n", json.str().c_str());
 }
-#endif
\ No newline at end of file
+
+#ifdef COROUTINES
+//
+// Prototype of an interleaved search: one thread runs several independent searches (tasks) as C++20 coroutines.
+// A task suspends right after playMove has prefetched the tt cluster and the pawn hash entry of the child node
+// and the next task runs while the memory is loaded. Every task uses the position of a search thread and does
+// its own iterative deepening starting at a different depth like the helper threads of the Lazy SMP search.
+// The search is a reduced version of alphabeta (no singular extension, probcut, tb probing, statistics, debug).
+// Build with 'make RubiChess-Coro' and compare it to the regular search with -corobench.
+//
+
+#define COARENASIZE (4 * 1024 * 1024)
+
+struct cocontext
+{
+    chessposition *pos;
+    coroutine_handle<> resumepoint;     // innermost suspended coroutine of this task
+    char *arena;                        // coroutine frames of a task are created and destroyed in LIFO order
+    size_t arenatop;
+    int depth;
+};
+
+// the task that runs at the moment; its arena is used for new coroutine frames
+static thread_local cocontext *coactive;
+
+class cotask
+{
+public:
+    struct promise_type
+    {
+        int value;
+        coroutine_handle<> continuation;
+
+        cotask get_return_object() { return cotask(coroutine_handle<promise_type>::from_promise(*this)); }
+        suspend_always initial_suspend() noexcept { return {}; }
+        struct finalawaiter {
+            bool await_ready() noexcept { return false; }
+            // continue with the caller; the root of a task returns to the scheduler
+            coroutine_handle<> await_suspend(coroutine_handle<promise_type> h) noexcept {
+                coroutine_handle<> c = h.promise().continuation;
+                return c ? c : noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        finalawaiter final_suspend() noexcept { return {}; }
+        void return_value(int v) { value = v; }
+        void unhandled_exception() { terminate(); }
+
+        static void* operator new(size_t size) {
+            size = (size + 63) & ~(size_t)63;
+            if (coactive->arenatop + size > COARENASIZE)
+                return ::operator new(size);
+            void *p = coactive->arena + coactive->arenatop;
+            coactive->arenatop += size;
+            return p;
+        }
+        static void operator delete(void *p, size_t size) {
+            size = (size + 63) & ~(size_t)63;
+            if ((char*)p < coactive->arena || (char*)p >= coactive->arena + COARENASIZE)
+                ::operator delete(p);
+            else
+                coactive->arenatop -= size;
+        }
+    };
+
+    coroutine_handle<promise_type> h;
+    explicit cotask(coroutine_handle<promise_type> ch) : h(ch) {}
+    cotask(cotask &&t) noexcept : h(t.h) { t.h = nullptr; }
+    cotask(const cotask&) = delete;
+    ~cotask() { if (h) h.destroy(); }
+
+    // awaiting a task starts it and continues the caller when it's finished
+    bool await_ready() { return false; }
+    coroutine_handle<> await_suspend(coroutine_handle<> caller) { h.promise().continuation = caller; return h; }
+    int await_resume() { return h.promise().value; }
+};
+
+// suspend the task and let the scheduler run the next one
+struct coyield
+{
+    cocontext *ctx;
+    bool await_ready() noexcept { return false; }
+    void await_suspend(coroutine_handle<> h) noexcept { ctx->resumepoint = h; }
+    void await_resume() noexcept {}
+};
+
+
+static cotask coAlphabeta(cocontext *ctx, int alpha, int beta, int depth)
+{
+    chessposition *pos = ctx->pos;
+    int score;
+    int hashscore = NOSCORE;
+    uint16_t hashmovecode = 0;
+    int staticeval = NOSCORE;
+    int bestscore = NOSCORE;
+    uint32_t bestcode = 0;
+    int eval_type = HASHALPHA;
+    chessmove *m;
+    const bool PVNode = (alpha != beta - 1);
+
+    pos->counters.addNode();
+    pos->pvline(pos->ply)[0] = 0;
+
+    int rep = pos->testRepetiton();
+    if (rep >= 2 || (pos->halfmovescounter >= 100 && !pos->isCheckbb))
+        co_return SCOREDRAW;
+
+    if (alpha < SCOREDRAW && pos->upcomingRepetition())
+    {
+        alpha = SCOREDRAW;
+        if (alpha >= beta)
+            co_return alpha;
+    }
+
+    if (en.stopLevel == ENGINESTOPIMMEDIATELY)
+        co_return beta;
+
+    if (depth <= 0 || pos->mstop >= MAXDEPTH - MOVESTACKRESERVE)
+        co_return pos->getQuiescence(alpha, beta, depth);
+
+    pos->excludemovestack[pos->mstop] = 0;
+    if (tp.probeHash(pos->hash, &hashscore, &staticeval, &hashmovecode, depth, alpha, beta, pos->ply) && !rep)
+    {
+        uint32_t fullhashmove = pos->shortMove2FullMove(hashmovecode);
+        if (!PVNode)
+            co_return hashscore;
+        if (fullhashmove)
+            pos->updatePvTable(fullhashmove, false);
+    }
+
+    int extendall = (pos->isCheckbb ? 1 : 0);
+    pos->prepareStack();
+
+    if (staticeval == NOSCORE)
+    {
+        if (pos->movestack[pos->mstop - 1].movecode == 0)
+            staticeval = -pos->staticevalstack[pos->mstop - 1] + CEVAL(eps.eTempo, 2);
+        else
+            staticeval = pos->getEval<NOTRACE>();
+    }
+    pos->staticevalstack[pos->mstop] = staticeval;
+    bool positionImproved = (pos->mstop >= pos->rootheight + 2 && pos->staticevalstack[pos->mstop] > pos->staticevalstack[pos->mstop - 2]);
+
+    // reverse futility pruning
+    if (!pos->isCheckbb && depth <= sps.futilitymindepth
+        && staticeval - depth * (sps.futilityreversedepthfactor - sps.futilityreverseimproved * positionImproved) > beta)
+        co_return staticeval;
+
+    // null move pruning without verification
+    int bestknownscore = (hashscore != NOSCORE ? hashscore : staticeval);
+    if (!PVNode && !pos->isCheckbb && depth >= sps.nmmindepth && bestknownscore >= beta && pos->ph < 255)
+    {
+        pos->playNullMove();
+        co_await coyield{ ctx };
+        int nmreduction = sps.nmmredbase + (depth / sps.nmmreddepthratio) + (bestknownscore - beta) / sps.nmmredevalratio + sps.nmmredpvfactor;
+        score = -co_await coAlphabeta(ctx, -beta, -beta + 1, depth - nmreduction);
+        pos->unplayNullMove();
+        if (score >= beta && abs(beta) < 5000)
+            co_return beta;
+    }
+
+    uint32_t lastmove = pos->movestack[pos->mstop - 1].movecode;
+    uint32_t counter = (lastmove ? pos->countermove[GETPIECE(lastmove)][GETCORRECTTO(lastmove)] : 0);
+    pos->killer[pos->ply + 1][0] = pos->killer[pos->ply + 1][1] = 0;
+
+    MoveSelector ms = {};
+    ms.SetPreferredMoves(pos, hashmovecode, pos->killer[pos->ply][0], pos->killer[pos->ply][1], counter, 0);
+
+    int legalMoves = 0;
+    int quietsPlayed = 0;
+    uint32_t quietMoves[MAXMOVELISTLENGTH];
+    while ((m = ms.next()))
+    {
+        ms.legalmovenum++;
+
+        // Late move pruning
+        if (depth < MAXLMPDEPTH && !ISTACTICAL(m->code) && bestscore > NOSCORE && quietsPlayed > lmptable[positionImproved][depth])
+        {
+            ms.state++;
+            continue;
+        }
+
+        // Late move reduction
+        int reduction = 0;
+        if (depth >= sps.lmrmindepth && !ISTACTICAL(m->code))
+        {
+            reduction = reductiontable[positionImproved][depth][min(63, legalMoves + 1)];
+            reduction -= pos->getHistory(m->code, ms.cmptr) / (sps.lmrstatsratio * 8);
+            reduction -= PVNode;
+            reduction = min(depth, max(0, reduction));
+        }
+        int effectiveDepth = depth + extendall - reduction;
+
+        if (!pos->playMove(m))
+            continue;
+
+        legalMoves++;
+        pos->LegalMoves[pos->ply] = ms.legalmovenum;
+
+        // the tt cluster and pawn hash entry of the child are prefetched; let the other tasks run while they are loaded
+        co_await coyield{ ctx };
+
+        if (reduction)
+        {
+            score = -co_await coAlphabeta(ctx, -alpha - 1, -alpha, effectiveDepth - 1);
+            if (score > alpha)
+            {
+                effectiveDepth += reduction;
+                score = -co_await coAlphabeta(ctx, -alpha - 1, -alpha, effectiveDepth - 1);
+            }
+        }
+        else if (!PVNode || legalMoves > 1)
+        {
+            score = -co_await coAlphabeta(ctx, -alpha - 1, -alpha, effectiveDepth - 1);
+        }
+        if (PVNode && (legalMoves == 1 || score > alpha))
+            score = -co_await coAlphabeta(ctx, -beta, -alpha, effectiveDepth - 1);
+
+        pos->unplayMove(m);
+
+        if (en.stopLevel == ENGINESTOPIMMEDIATELY)
+            co_return beta;
+
+        if (score > bestscore)
+        {
+            bestscore = score;
+            bestcode = m->code;
+
+            if (score >= beta)
+            {
+                if (!ISTACTICAL(m->code))
+                {
+                    pos->updateHistory(m->code, ms.cmptr, depth * depth);
+                    for (int i = 0; i < quietsPlayed; i++)
+                        pos->updateHistory(quietMoves[i], ms.cmptr, -(depth * depth));
+                    if (pos->killer[pos->ply][0] != m->code)
+                    {
+                        pos->killer[pos->ply][1] = pos->killer[pos->ply][0];
+                        pos->killer[pos->ply][0] = m->code;
+                    }
+                    if (lastmove)
+                        pos->countermove[GETPIECE(lastmove)][GETCORRECTTO(lastmove)] = m->code;
+                }
+                tp.addHash(pos->hash, FIXMATESCOREADD(score, pos->ply), staticeval, HASHBETA, effectiveDepth, (uint16_t)bestcode);
+                co_return score;
+            }
+
+            if (score > alpha)
+            {
+                alpha = score;
+                eval_type = HASHEXACT;
+                pos->updatePvTable(bestcode, true);
+            }
+        }
+
+        if (!ISTACTICAL(m->code))
+            quietMoves[quietsPlayed++] = m->code;
+    }
+
+    if (legalMoves == 0)
+        co_return (pos->isCheckbb ? SCOREBLACKWINS + pos->ply : SCOREDRAW);
+
+    tp.addHash(pos->hash, FIXMATESCOREADD(bestscore, pos->ply), staticeval, eval_type, depth, (uint16_t)bestcode);
+    co_return bestscore;
+}
+
+
+static cotask coRootsearch(cocontext *ctx, int depth)
+{
+    chessposition *pos = ctx->pos;
+    int alpha = SCOREBLACKWINS;
+    int beta = SCOREWHITEWINS;
+    int bestscore = NOSCORE;
+    int bestindex = 0;
+
+    pos->counters.addNode();
+    pos->staticevalstack[pos->mstop] = pos->getEval<NOTRACE>();
+    for (int i = 0; i < pos->rootmovelist.length; i++)
+    {
+        chessmove *m = &pos->rootmovelist.move[i];
+        pos->playMove(m);
+        co_await coyield{ ctx };
+        int score = alpha + 1;
+        if (i)
+            score = -co_await coAlphabeta(ctx, -alpha - 1, -alpha, depth - 1);
+        if (score > alpha)
+            score = -co_await coAlphabeta(ctx, -beta, -alpha, depth - 1);
+        pos->unplayMove(m);
+
+        if (en.stopLevel == ENGINESTOPIMMEDIATELY)
+            break;
+
+        if (score > bestscore)
+        {
+            bestscore = score;
+            bestindex = i;
+            alpha = max(alpha, score);
+        }
+    }
+    // search the best move first in the next iteration
+    swap(pos->rootmovelist.move[0], pos->rootmovelist.move[bestindex]);
+    co_return bestscore;
+}
+
+
+// Search the prepared root position with <tasks> interleaved tasks for <msec> milliseconds in the calling thread
+U64 coroutineSearch(int tasks, int msec)
+{
+    tasks = min(tasks, en.Threads);
+    cocontext *ctx = new cocontext[tasks];
+    cotask **roots = new cotask*[tasks];
+    for (int i = 0; i < tasks; i++)
+    {
+        ctx[i].pos = &en.sthread[i].pos;
+        ctx[i].arena = (char*)allocalign64(COARENASIZE);
+        ctx[i].arenatop = 0;
+        ctx[i].depth = 1 + i;
+        coactive = &ctx[i];
+        roots[i] = new cotask(coRootsearch(&ctx[i], ctx[i].depth));
+        ctx[i].resumepoint = roots[i]->h;
+    }
+
+    en.stopLevel = ENGINERUN;
+    U64 endtime = getTime() + (U64)msec * en.frequency / 1000;
+    int running = tasks;
+    for (unsigned int n = 0; running; n++)
+    {
+        if (!(n & 0xff) && en.stopLevel < ENGINESTOPIMMEDIATELY && getTime() >= endtime)
+            en.stopLevel = ENGINESTOPIMMEDIATELY;
+
+        for (int i = 0; i < tasks; i++)
+        {
+            if (!roots[i])
+                continue;
+            coactive = &ctx[i];
+            ctx[i].resumepoint.resume();
+            if (!roots[i]->h.done())
+                continue;
+
+            // iteration of this task is finished; start the next one or retire the task when time is over
+            delete roots[i];
+            roots[i] = nullptr;
+            if (en.stopLevel == ENGINESTOPIMMEDIATELY || ctx[i].depth >= MAXDEPTH - 1)
+            {
+                running--;
+                continue;
+            }
+            ctx[i].depth++;
+            roots[i] = new cotask(coRootsearch(&ctx[i], ctx[i].depth));
+            ctx[i].resumepoint = roots[i]->h;
+        }
+    }
+    en.stopLevel = ENGINETERMINATEDSEARCH;
+
+    for (int i = 0; i < tasks; i++)
+        freealigned64(ctx[i].arena);
+    delete[] roots;
+    delete[] ctx;
+    return en.getTotalNodes();
+}
+#endif
@@ -0,0 +1,303 @@
+/*
+  RubiChess is a UCI chess playing engine by Andreas Matthies.
+
+  RubiChess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  RubiChess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "RubiChess.h"
+
+//
+// Binary search tree trace for offline analysis
+// Build with SEARCHTRACE and set the SearchTraceFile option; every alphabeta and qsearch node is logged
+// as a tracerecord. Use -traceanalyze <file> to get some statistics of the traced trees.
+//
+
+#ifdef SEARCHTRACE
+
+bool SearchTrace::start(string filename)
+{
+    file = fopen(filename.c_str(), "wb");
+    if (!file)
+        return false;
+
+    tracefileheader header;
+    memcpy(header.magic, TRACEMAGIC, sizeof(header.magic));
+    header.version = TRACEVERSION;
+    header.recordsize = sizeof(tracerecord);
+    header.reserved = 0;
+    fwrite(&header, sizeof(header), 1, file);
+
+    terminating = false;
+    writerthr = thread(&SearchTrace::writerLoop, this);
+    return true;
+}
+
+
+void SearchTrace::stop()
+{
+    if (!file)
+        return;
+
+    terminating = true;
+    if (writerthr.joinable())
+        writerthr.join();
+    flush();
+    fclose(file);
+    file = nullptr;
+
+    for (int i = 0; i < MAXTHREADS; i++)
+    {
+        freealigned64(buffer[i]);
+        buffer[i] = nullptr;
+    }
+}
+
+
+// Called before the threads start searching; allocates missing buffers and marks the start of the search
+void SearchTrace::newSearch(int threads, U64 roothash)
+{
+    if (!file)
+        return;
+
+    {
+        lock_guard<mutex> lock(buffermutex);
+        for (int i = 0; i < threads; i++)
+        {
+            if (buffer[i])
+                continue;
+            buffer[i] = (tracebuffer*)allocalign64(sizeof(tracebuffer));
+            memset((void*)buffer[i], 0, sizeof(tracebuffer));
+        }
+    }
+
+    tracerecord r;
+    memset(&r, 0, sizeof(r));
+    r.hash = roothash;
+    r.flags = TRACESEARCH;
+    write(0, &r);
+}
+
+
+void SearchTrace::write(int threadindex, tracerecord *r)
+{
+    tracebuffer *tb = buffer[threadindex];
+    if (!tb)
+        return;
+
+    U64 h = tb->head.load(memory_order_relaxed);
+    while (h - tb->tail.load(memory_order_acquire) >= TRACEBUFFERSIZE)
+        this_thread::yield();
+    tb->record[h & (TRACEBUFFERSIZE - 1)] = *r;
+    tb->head.store(h + 1, memory_order_release);
+}
+
+
+void SearchTrace::flush()
+{
+    lock_guard<mutex> lock(buffermutex);
+    bool written = false;
+    for (int i = 0; i < MAXTHREADS; i++)
+    {
+        tracebuffer *tb = buffer[i];
+        if (!tb)
+            continue;
+        U64 h = tb->head.load(memory_order_acquire);
+        U64 t = tb->tail.load(memory_order_relaxed);
+        while (t < h)
+        {
+            // write up to the end of the ring in one go
+            size_t index = (size_t)(t & (TRACEBUFFERSIZE - 1));
+            size_t num = (size_t)min(h - t, (U64)(TRACEBUFFERSIZE - index));
+            fwrite(&tb->record[index], sizeof(tracerecord), num, file);
+            t += num;
+            written = true;
+        }
+        tb->tail.store(t, memory_order_release);
+    }
+    if (written)
+        fflush(file);
+}
+
+
+void SearchTrace::writerLoop()
+{
+    while (!terminating)
+    {
+        flush();
+        Sleep(TRACEFLUSHMS);
+    }
+}
+
+SearchTrace strace;
+
+#endif
+
+
+//
+// Reader of the trace files
+//
+
+static const char *traceexitname[TE_NUM] = {
+    "moveloop", "draw", "stop", "tt", "tb", "qsearch", "razor", "revfutility", "nullmove",
+    "probcut", "multicut", "mate", "standpat", "delta"
+};
+
+struct tracenodestats {
+    U64 n;
+    U64 exits[TE_NUM];
+    U64 type[3];        // nodes of the move loop by bound: exact (pv), alpha (all), beta (cut)
+    U64 subtree;        // sum of the subtree sizes
+};
+
+
+static void addTraceNode(tracenodestats *s, tracerecord *r)
+{
+    s->n++;
+    s->exits[r->exit]++;
+    s->subtree += r->nodes;
+    if (r->exit == TE_MOVELOOP)
+        s->type[r->score >= r->beta ? HASHBETA : r->score <= r->alpha ? HASHALPHA : HASHEXACT]++;
+}
+
+
+static double tracePercent(U64 part, U64 all)
+{
+    return (all ? 100.0 * part / all : 0.0);
+}
+
+
+static void printTraceExits(const char *name, tracenodestats *s)
+{
+    printf("%s nodes: %llu\n", name, (unsigned long long)s->n);
+    for (int i = 0; i < TE_NUM; i++)
+        if (s->exits[i])
+            printf("  %-12s %12llu  %6.2f%%\n", traceexitname[i], (unsigned long long)s->exits[i], tracePercent(s->exits[i], s->n));
+    U64 loop = s->exits[TE_MOVELOOP];
+    if (loop)
+        printf("  node types of the move loop:  pv %6.2f%%  cut %6.2f%%  all %6.2f%%\n",
+            tracePercent(s->type[HASHEXACT], loop), tracePercent(s->type[HASHBETA], loop), tracePercent(s->type[HASHALPHA], loop));
+}
+
+
+void traceAnalyze(string filename)
+{
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f)
+    {
+        printf("Cannot open trace file %s\n", filename.c_str());
+        return;
+    }
+
+    tracefileheader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TRACEMAGIC, sizeof(header.magic)) != 0
+        || header.version != TRACEVERSION || header.recordsize != sizeof(tracerecord))
+    {
+        printf("%s is not a trace file of this version.\n", filename.c_str());
+        fclose(f);
+        return;
+    }
+
+    tracenodestats ab, qs;
+    tracenodestats abply[MAXDEPTH], qsply[MAXDEPTH], abdepth[MAXDEPTH];
+    memset(&ab, 0, sizeof(ab));
+    memset(&qs, 0, sizeof(qs));
+    memset(abply, 0, sizeof(abply));
+    memset(qsply, 0, sizeof(qsply));
+    memset(abdepth, 0, sizeof(abdepth));
+    U64 searches = 0;
+    U64 pvnodes = 0;
+    U64 checknodes = 0;
+    U64 singularnodes = 0;
+    int maxply = 0;
+    int maxdepth = 0;
+    int maxthread = 0;
+
+    const size_t chunk = 4096;
+    tracerecord *records = new tracerecord[chunk];
+    size_t num;
+    while ((num = fread(records, sizeof(tracerecord), chunk, f)) > 0)
+    {
+        for (size_t i = 0; i < num; i++)
+        {
+            tracerecord *r = &records[i];
+            if (r->flags & TRACESEARCH)
+            {
+                searches++;
+                continue;
+            }
+            if (r->exit >= TE_NUM)
+                continue;
+            maxply = max(maxply, (int)r->ply);
+            maxthread = max(maxthread, (int)r->thread);
+            pvnodes += ((r->flags & TRACEPVNODE) != 0);
+            checknodes += ((r->flags & TRACECHECK) != 0);
+            if (r->flags & TRACEQS)
+            {
+                addTraceNode(&qs, r);
+                addTraceNode(&qsply[r->ply], r);
+            }
+            else
+            {
+                singularnodes += ((r->flags & TRACESINGULAR) != 0);
+                addTraceNode(&ab, r);
+                addTraceNode(&abply[r->ply], r);
+                int d = max(0, min(MAXDEPTH - 1, (int)r->depth));
+                maxdepth = max(maxdepth, d);
+                addTraceNode(&abdepth[d], r);
+            }
+        }
+    }
+    delete[] records;
+    fclose(f);
+
+    U64 all = ab.n + qs.n;
+    printf("Trace file:     %s\n", filename.c_str());
+    printf("Searches:       %llu\n", (unsigned long long)searches);
+    printf("Threads:        %d\n", maxthread + 1);
+    printf("Nodes:          %llu  (pv %.2f%%  in check %.2f%%  singular search %.2f%%)\n", (unsigned long long)all,
+        tracePercent(pvnodes, all), tracePercent(checknodes, all), tracePercent(singularnodes, all));
+    if (!all)
+        return;
+
+    printTraceExits("Alphabeta", &ab);
+    printTraceExits("Qsearch", &qs);
+
+    printf("\nPer ply:\n  ply    alphabeta      qsearch    tt%%  pruned%%    cut%%    all%%     pv%%   avg.subtree\n");
+    for (int p = 0; p <= maxply; p++)
+    {
+        tracenodestats *s = &abply[p];
+        if (!s->n && !qsply[p].n)
+            continue;
+        U64 loop = s->exits[TE_MOVELOOP];
+        U64 pruned = s->exits[TE_RAZOR] + s->exits[TE_REVFUTILITY] + s->exits[TE_NULLMOVE] + s->exits[TE_PROBCUT] + s->exits[TE_MULTICUT];
+        printf("  %3d %12llu %12llu %6.2f %8.2f %7.2f %7.2f %7.2f %13.1f\n", p, (unsigned long long)s->n, (unsigned long long)qsply[p].n,
+            tracePercent(s->exits[TE_TT], s->n), tracePercent(pruned, s->n),
+            tracePercent(s->type[HASHBETA], loop), tracePercent(s->type[HASHALPHA], loop), tracePercent(s->type[HASHEXACT], loop),
+            s->n ? (double)s->subtree / s->n : 0.0);
+    }
+
+    printf("\nPer depth (alphabeta):\n  depth        nodes    tt%%  razor%%  revfut%%  nullmove%%  probcut%%  moveloop%%    cut%%   avg.subtree\n");
+    for (int d = 0; d <= maxdepth; d++)
+    {
+        tracenodestats *s = &abdepth[d];
+        if (!s->n)
+            continue;
+        U64 loop = s->exits[TE_MOVELOOP];
+        printf("  %5d %12llu %6.2f %7.2f %8.2f %10.2f %9.2f %10.2f %7.2f %13.1f\n", d, (unsigned long long)s->n,
+            tracePercent(s->exits[TE_TT], s->n), tracePercent(s->exits[TE_RAZOR], s->n), tracePercent(s->exits[TE_REVFUTILITY], s->n),
+            tracePercent(s->exits[TE_NULLMOVE], s->n), tracePercent(s->exits[TE_PROBCUT], s->n), tracePercent(loop, s->n),
+            tracePercent(s->type[HASHBETA], loop), (double)s->subtree / s->n);
+    }
+}
@@ -377,6 +377,7 @@ static int probe_ab(int alpha, int beta, int *success, chessposition *pos)
 //  2 : win
 int probe_wdl(int *success, chessposition *pos)
 {
+    PROFILESCOPE(PROF_PROBEWDL);
     *success = 1;
     int best_cap = -3, best_ep = -3;
     int i;
@@ -123,7 +123,6 @@ bool PGNtoFEN(int depth)
 {
     pos.tps.count = 0;
     pos.pwnhsh.setSize(1);
-    pos.mtrlhsh.init();
 
     int gamescount = 0;
     fenWritten = 0ULL;
@@ -243,7 +242,7 @@ bool PGNtoFEN(int depth)
                             // AGE mode (search and apply the pv of this search)
                             score = pos.alphabeta(SCOREBLACKWINS, SCOREWHITEWINS, depth);
                             int s2m = pos.state & S2MMASK;
-                            uint32_t* pvt = pos.pvtable[pos.ply];
+                            uint32_t* pvt = pos.pvline(pos.ply);
                             int num = pos.applyPv(pvt);
                             if ((pos.state & S2MMASK) != s2m)
                                 score = -score;
@@ -1421,7 +1420,6 @@ void parseTune(vector<string> commandargs)
 
 void tuneInit()
 {
-    pos.mtrlhsh.init();
     pos.pwnhsh.setSize(0);
     pos.tps.count = 0;
     pos.resetStats();
@@ -1433,7 +1431,6 @@ void tuneCleanup()
 {
     if (texelpts)
         free(texelpts);
-    pos.mtrlhsh.remove();
     pos.pwnhsh.remove();
 }
 #endif // EVALTUNE
@@ -60,6 +60,50 @@ zobrist::zobrist()
     }
 
     s2m = getRnd();
+    initCuckoo();
+}
+
+
+// Fill the cuckoo tables with the hash differences of all non-pawn moves on an empty board.
+// Uses its own geometry instead of the attack tables as these are initialized later by the engine.
+void zobrist::initCuckoo()
+{
+    memset(cuckoo, 0, sizeof(cuckoo));
+    memset(cuckoomove, 0, sizeof(cuckoomove));
+    for (int pc = WKNIGHT; pc <= BKING; pc++)
+    {
+        int p = pc >> 1;
+        for (int from = 0; from < 64; from++)
+        {
+            for (int to = from + 1; to < 64; to++)
+            {
+                int dr = abs(RANK(from) - RANK(to));
+                int df = abs(FILE(from) - FILE(to));
+                bool diagonal = (dr == df);
+                bool straight = (!dr || !df);
+                bool reachable = (p == KNIGHT && dr * df == 2)
+                    || (p == BISHOP && diagonal)
+                    || (p == ROOK && straight)
+                    || (p == QUEEN && (diagonal || straight))
+                    || (p == KING && max(dr, df) == 1);
+                if (!reachable)
+                    continue;
+
+                U64 key = boardtable[(from << 4) | pc] ^ boardtable[(to << 4) | pc] ^ s2m;
+                uint16_t move = (uint16_t)((from << 6) | to);
+                int i = CUCKOOH1(key);
+                // insert and kick out the former entry to its alternative slot until a free slot is found
+                while (true)
+                {
+                    swap(cuckoo[i], key);
+                    swap(cuckoomove[i], move);
+                    if (!move)
+                        break;
+                    i = (i == (int)CUCKOOH1(key)) ? CUCKOOH2(key) : CUCKOOH1(key);
+                }
+            }
+        }
+    }
 }
 
 unsigned long long zobrist::getRnd()
@@ -205,12 +249,16 @@ unsigned int transposition::getUsedinPermill()
 }
 
 
-void transposition::addHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode)
+void transposition::addHash(U64 hash, int val, int16_t staticeval, int bound, int depth, uint16_t movecode, bool clustershare)
 {
+    PROFILESCOPE(PROF_ADDHASH);
 #ifdef EVALTUNE
     // don't use transposition table when tuning evaluation
     return;
 #endif
+    if (cl.enabled && clustershare && depth >= CLUSTERTTMINDEPTH)
+        cl.queueHash(hash, val, staticeval, bound, depth, movecode);
+
     unsigned long long index = hash & sizemask;
     transpositioncluster *cluster = &table[index];
     transpositionentry *e;
@@ -286,6 +334,7 @@ void transposition::printHashentry(U64 hash)
 
 bool transposition::probeHash(U64 hash, int *val, int *staticeval, uint16_t *movecode, int depth, int alpha, int beta, int ply)
 {
+    PROFILESCOPE(PROF_PROBEHASH);
 #ifdef EVALTUNE
     // don't use transposition table when tuning evaluation
     return false;
@@ -357,6 +406,7 @@ void Pawnhash::setSize(int sizeMb)
 void Pawnhash::remove()
 {
     freealigned64(table);
+    table = nullptr;
 }
 
 
@@ -382,28 +432,88 @@ bool Pawnhash::probeHash(U64 hash, pawnhashentry **entry)
 }
 
 
-void Materialhash::init()
+void SharedPawnhash::setSize(int sizeMb)
 {
-    size_t tablesize = (size_t)MATERIALHASHSIZE * sizeof(Materialhashentry);
-    table = (Materialhashentry*)allocalign64(tablesize);
-    memset(table, 0, tablesize);
+    int msb = 0;
+    sizeMb = max(sizeMb, 1);
+    U64 size = ((U64)sizeMb << 20) / sizeof(sharedpawnhashcluster);
+    GETMSB(msb, size);
+    size = (1ULL << msb);
+
+    sizemask = size - 1;
+    sizeInBytes = (size_t)size * sizeof(sharedpawnhashcluster);
+    table = (sharedpawnhashcluster*)allocalign64(sizeInBytes);
+    memset(table, 0, sizeInBytes);
 }
 
-void Materialhash::remove()
+
+void SharedPawnhash::remove()
 {
     freealigned64(table);
+    table = nullptr;
+    sizeInBytes = 0;
 }
 
-bool  Materialhash::probeHash(U64 hash, Materialhashentry **entry)
+
+bool SharedPawnhash::probeHash(U64 hash, U64 *pawns, pawnhashentry *entry)
 {
-    *entry = &table[hash & MATERIALHASHMASK];
-    if ((*entry)->hash == hash)
-        return true;
+#ifdef EVALTUNE
+    (void)pawns;
+#endif
+    sharedpawnhashcluster *data = &table[hash & sizemask];
+    for (int i = 0; i < SHAREDPAWNHASHBUCKETNUM; i++)
+    {
+        // Work on a local copy; another thread may overwrite the slot meanwhile
+        sharedpawnhashentry e = data->entry[i];
+        if (e.check == SHAREDPAWNHASHCHECK(hash, e.value, e.passedpawns))
+        {
+#ifndef EVALTUNE
+            // don't use pawn hash when tuning evaluation
+            entry->hashupper = (uint32_t)(hash >> 32);
+            entry->value = e.value;
+            for (int me = WHITE; me <= BLACK; me++)
+            {
+                U64 p = pawns[me];
+                U64 left = (me ? (p & ~FILEHBB) >> 7 : (p & ~FILEABB) << 7);
+                U64 right = (me ? (p & ~FILEABB) >> 9 : (p & ~FILEHBB) << 9);
+                U64 files = p | (p >> 32);
+                files |= files >> 16;
+                files |= files >> 8;
+                entry->passedpawnbb[me] = e.passedpawns & p;
+                entry->attacked[me] = left | right;
+                entry->attackedBy2[me] = left & right;
+                entry->semiopen[me] = (unsigned char)~files;
+            }
+            U64 allpawns = pawns[WHITE] | pawns[BLACK];
+            entry->bothFlanks = ((allpawns & FLANKLEFT) && (allpawns & FLANKRIGHT));
+            return true;
+#endif
+        }
+    }
+    entry->hashupper = (uint32_t)(hash >> 32);
+    entry->value = 0;
+    entry->semiopen[0] = entry->semiopen[1] = 0xff;
+    entry->passedpawnbb[0] = entry->passedpawnbb[1] = 0ULL;
+    entry->attacked[0] = entry->attacked[1] = 0ULL;
+    entry->attackedBy2[0] = entry->attackedBy2[1] = 0ULL;
 
-    (*entry)->endgame = nullptr;
-    (*entry)->hash = hash;
     return false;
 }
 
 
+void SharedPawnhash::addHash(U64 hash, pawnhashentry *entry)
+{
+    sharedpawnhashcluster *data = &table[hash & sizemask];
+    U64 passedpawns = entry->passedpawnbb[WHITE] | entry->passedpawnbb[BLACK];
+
+    // Insert at the front and let the oldest entry of the bucket fall out
+    for (int i = SHAREDPAWNHASHBUCKETNUM - 1; i > 0; i--)
+        data->entry[i] = data->entry[i - 1];
+    data->entry[0].value = entry->value;
+    data->entry[0].passedpawns = passedpawns;
+    data->entry[0].check = SHAREDPAWNHASHCHECK(hash, entry->value, passedpawns);
+}
+
+
 transposition tp;
+SharedPawnhash sph;
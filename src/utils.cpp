@@ -464,6 +464,239 @@ void Sleep(long x)
 #endif
 
 
+#ifdef PROFILING
+thread_local profiledata *profilethread = nullptr;
+static mutex profilemutex;
+static vector<profiledata*> profilethreads;
+static profiledata profileretired;      // sum of the threads that already ended
+static int profileretiredthreads;
+static U64 profilestartcycles, profilestarttime;
+
+static const char *profilesectionname[PROF_NUM] = {
+    "getEval classical", "getEval NNUE", "UpdateAccumulator", "RefreshAccumulator", "Propagate",
+    "CreateMovelist", "MoveSelector::next", "see", "probeHash", "addHash", "probe_wdl", "playMove", "unplayMove"
+};
+
+// Called by the first profiled section of a thread
+profiledata* profileRegisterThread()
+{
+    lock_guard<mutex> lock(profilemutex);
+    profilethread = (profiledata*)allocalign64(sizeof(profiledata));
+    memset((void*)profilethread, 0, sizeof(profiledata));
+    profilethreads.push_back(profilethread);
+    if (!profilestartcycles)
+    {
+        profilestartcycles = profileCycles();
+        profilestarttime = getTime();
+    }
+    return profilethread;
+}
+
+
+// Called by a thread before it ends; its counts are added to the retired ones so the results don't get lost
+void profileUnregisterThread()
+{
+    if (!profilethread)
+        return;
+    lock_guard<mutex> lock(profilemutex);
+    for (int i = 0; i < PROF_NUM; i++)
+    {
+        profileretired.cycles[i] += profilethread->cycles[i];
+        profileretired.calls[i] += profilethread->calls[i];
+    }
+    profileretiredthreads++;
+    profilethreads.erase(find(profilethreads.begin(), profilethreads.end(), profilethread));
+    freealigned64(profilethread);
+    profilethread = nullptr;
+}
+
+
+void profileReset()
+{
+    lock_guard<mutex> lock(profilemutex);
+    for (auto pd : profilethreads)
+        memset((void*)pd, 0, sizeof(profiledata));
+    memset((void*)&profileretired, 0, sizeof(profiledata));
+    profileretiredthreads = 0;
+    profilestartcycles = profileCycles();
+    profilestarttime = getTime();
+}
+
+
+static void profilePrintTable(FILE *out, profiledata *pd, U64 elapsedcycles, double cyclespersec)
+{
+    fprintf(out, "Section                         Calls         Cycles  Cycles/Call   Time (sec)   %% of time\n");
+    for (int i = 0; i < PROF_NUM; i++)
+    {
+        if (!pd->calls[i])
+            continue;
+        fprintf(out, "%-20s %16llu %14llu %12.1f %12.3f %11.2f\n", profilesectionname[i], pd->calls[i], pd->cycles[i],
+            pd->cycles[i] / (double)pd->calls[i], pd->cycles[i] / cyclespersec, 100.0 * pd->cycles[i] / (double)elapsedcycles);
+    }
+}
+
+
+void profilePrint(FILE *out)
+{
+    lock_guard<mutex> lock(profilemutex);
+    U64 elapsedcycles = max(1ULL, (unsigned long long)(profileCycles() - profilestartcycles));
+    double elapsedsec = max(1ULL, (unsigned long long)(getTime() - profilestarttime)) / (double)en.frequency;
+    double cyclespersec = elapsedcycles / elapsedsec;
+    profiledata total = profileretired;
+    for (auto pd : profilethreads)
+        for (int i = 0; i < PROF_NUM; i++)
+        {
+            total.cycles[i] += pd->cycles[i];
+            total.calls[i] += pd->calls[i];
+        }
+
+    fprintf(out, "\nProfile of %d thread(s) over %.3f sec. (%.0f MHz cycle counter); nested sections are included in the outer ones\n",
+        (int)profilethreads.size() + profileretiredthreads, elapsedsec, cyclespersec / 1e6);
+    fprintf(out, "%% of time is relative to the elapsed time of one thread\n");
+    profilePrintTable(out, &total, elapsedcycles, cyclespersec);
+    if (profilethreads.size() > 1)
+    {
+        for (size_t t = 0; t < profilethreads.size(); t++)
+        {
+            fprintf(out, "\nThread %d:\n", (int)t);
+            profilePrintTable(out, profilethreads[t], elapsedcycles, cyclespersec);
+        }
+    }
+}
+#endif
+
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+static const uint64_t perfhardwareconfig[PERF_NUM][2] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+static const uint64_t perfsoftwareconfig[PERF_SOFTNUM] = {
+    PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS
+};
+
+
+int perfcounters::openCounter(int tid, int counter)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    if (mode == PERFHARDWARE)
+    {
+        attr.type = (uint32_t)perfhardwareconfig[counter][0];
+        attr.config = perfhardwareconfig[counter][1];
+    }
+    else
+    {
+        if (counter >= PERF_SOFTNUM)
+            return -1;
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = perfsoftwareconfig[counter];
+    }
+    attr.disabled = 1;
+    // the software events like context switches happen in the kernel
+    attr.exclude_kernel = (mode == PERFHARDWARE);
+    attr.exclude_hv = 1;
+    // more events than hardware counters are multiplexed; scale by the time the event really counted
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+
+// Find out what we are allowed to count
+PerfCounterMode perfcounters::init()
+{
+    int tid = (int)syscall(SYS_gettid);
+    for (mode = PERFHARDWARE; mode > PERFNONE; mode = (PerfCounterMode)(mode - 1))
+    {
+        int f = openCounter(tid, PERF_CYCLES);
+        if (f >= 0)
+        {
+            close(f);
+            break;
+        }
+    }
+    return mode;
+}
+
+
+// Open the counters for every thread that exists now; the search threads are already waiting in the pool
+void perfcounters::start()
+{
+    numtasks = 0;
+    if (mode == PERFNONE)
+        return;
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir)
+        return;
+    dirent *entry;
+    while ((entry = readdir(dir)) && numtasks <= MAXTHREADS)
+    {
+        int tid = atoi(entry->d_name);
+        if (tid <= 0)
+            continue;
+        for (int i = 0; i < PERF_NUM; i++)
+            fd[numtasks][i] = openCounter(tid, i);
+        numtasks++;
+    }
+    closedir(dir);
+
+    for (int t = 0; t < numtasks; t++)
+        for (int i = 0; i < PERF_NUM; i++)
+            if (fd[t][i] >= 0)
+                ioctl(fd[t][i], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+
+void perfcounters::stop(perfcountervalues *v)
+{
+    memset(v, 0, sizeof(*v));
+    for (int t = 0; t < numtasks; t++)
+        for (int i = 0; i < PERF_NUM; i++)
+        {
+            if (fd[t][i] < 0)
+                continue;
+            ioctl(fd[t][i], PERF_EVENT_IOC_DISABLE, 0);
+            U64 data[3];    // value, time enabled, time running
+            if (read(fd[t][i], data, sizeof(data)) == sizeof(data))
+            {
+                v->valid[i] = true;
+                if (data[2])
+                    v->value[i] += (U64)((double)data[0] * data[1] / data[2]);
+            }
+            close(fd[t][i]);
+        }
+    numtasks = 0;
+}
+
+#else
+
+PerfCounterMode perfcounters::init()
+{
+    return mode = PERFNONE;
+}
+
+void perfcounters::start() {}
+
+void perfcounters::stop(perfcountervalues *v)
+{
+    memset(v, 0, sizeof(*v));
+}
+
+#endif
+
+
 #ifdef STACKDEBUG
 // Thanks to http://blog.aaronballman.com/2011/04/generating-a-stack-crawl/ for the following stacktracer
 void GetStackWalk(chessposition *pos, const char* message, const char* _File, int Line, int num, ...)